@@ -30,12 +30,14 @@
 // as macros
 #define DRTI_RETALIGN 32
 #define DRTI_STASH_BYTES 8
-#define DRTI_VERSION 1
+#define DRTI_VERSION 2
 #define DRTI_MAGIC (0xd511 + (DRTI_VERSION << 16))
 
 namespace drti
 {
   constexpr int housekeeping_interval = 1000;
+  //! Number of pointer arguments per function for value profiling
+  constexpr unsigned profiled_args = 2;
 }
 
 #endif // configuration_rmg_20191028_included
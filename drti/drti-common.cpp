@@ -29,6 +29,121 @@
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+
+//! True if every use of the value only reads through it, looking
+//! through casts and address arithmetic
+static bool only_loaded(const llvm::Value& value)
+{
+    for(const llvm::User* user: value.users())
+    {
+        if(auto load = llvm::dyn_cast<llvm::LoadInst>(user))
+        {
+            if(load->getPointerOperand() != &value)
+            {
+                return false;
+            }
+        }
+        else if(llvm::isa<llvm::GEPOperator>(user)
+                || llvm::isa<llvm::BitCastOperator>(user))
+        {
+            if(!only_loaded(*user))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool drti::is_profiled_argument(const llvm::Argument& argument)
+{
+    // The caller's own storage for a struct argument or return value
+    // is not interesting
+    return argument.getType()->isPointerTy()
+        && !argument.hasStructRetAttr()
+        && !argument.hasByValAttr();
+}
+
+llvm::LoadInst* drti::virtual_call_vtable(llvm::CallBase& call)
+{
+    // Looks for the usual code generated for a virtual call:
+    //   %vtable = load (bitcast %this)
+    //   %vfn = getelementptr %vtable, slot
+    //   %fn = load %vfn
+    //   call %fn(%this, ...)
+    // where the getelementptr is absent for the first slot
+    if(call.arg_size() == 0)
+    {
+        return nullptr;
+    }
+
+    auto function = llvm::dyn_cast<llvm::LoadInst>(
+        call.getCalledOperand()->stripPointerCasts());
+    if(!function)
+    {
+        return nullptr;
+    }
+
+    llvm::Value* slot = function->getPointerOperand()->stripPointerCasts();
+    if(auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(slot))
+    {
+        if(!gep->hasAllConstantIndices())
+        {
+            return nullptr;
+        }
+        slot = gep->getPointerOperand()->stripPointerCasts();
+    }
+
+    auto vtable = llvm::dyn_cast<llvm::LoadInst>(slot);
+    if(!vtable
+       || vtable->getPointerOperand()->stripPointerCasts()
+          != call.getArgOperand(0)->stripPointerCasts())
+    {
+        return nullptr;
+    }
+
+    return vtable;
+}
+
+int64_t drti::virtual_call_offset(
+    llvm::CallBase& call, const llvm::DataLayout& layout)
+{
+    auto function = llvm::cast<llvm::LoadInst>(
+        call.getCalledOperand()->stripPointerCasts());
+    auto gep = llvm::dyn_cast<llvm::GEPOperator>(
+        function->getPointerOperand()->stripPointerCasts());
+
+    llvm::APInt offset(64, 0);
+    if(gep)
+    {
+        gep->accumulateConstantOffset(layout, offset);
+    }
+    return offset.getSExtValue();
+}
+
+bool drti::constant_address_escapes(const llvm::GlobalVariable& variable)
+{
+    if(variable.isDeclaration() || !variable.hasLocalLinkage())
+    {
+        // Other modules can see this address
+        return true;
+    }
+    else if(variable.hasGlobalUnnamedAddr())
+    {
+        // Only the contents are significant, e.g. string literals
+        return false;
+    }
+    else
+    {
+        return !only_loaded(variable);
+    }
+}
 
 void drti::visit_listed_globals(
     llvm::Module& module,
@@ -36,27 +151,23 @@ void drti::visit_listed_globals(
 {
     for(llvm::GlobalVariable& variable: module.globals())
     {
-        // TODO - handle (non-constant) variable definitions as well.
-        // These also have to resolve against the globals from the
-        // ahead-of-time compilation. Probably constants are different
-        // because we want their values at (JIT) compile-time, but
-        // then again if they're large or their addresses escape we
-        // could be in trouble.
-        // if(variable.isDeclaration())
-        if(variable.isConstant())
-        {
-            // TODO - don't force address equality for constants
-            // because we want their values at (JIT) compile-time.
-            // However if their addresses are taken this could break
-            // code.
-        }
-        else if(variable.getName().startswith("llvm."))
+        // IMPORTANT - this runs on the same bitcode in drti-decorate
+        // and the runtime, so the filtering has to depend only on the
+        // module contents
+        if(variable.getName().startswith("llvm."))
         {
             // We don't want to interfere with magic "variables" like
             // llvm.global_ctors or llvm.used
         }
+        else if(variable.isConstant() && !constant_address_escapes(variable))
+        {
+            // The JIT gets its own copy of the constant, and the
+            // optimizer can fold loads from it
+        }
         else
         {
+            // Includes constants that need the original address, for
+            // which the runtime still makes the initializer available
             callback(variable);
         }
     }
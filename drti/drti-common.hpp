@@ -28,16 +28,38 @@
 #ifndef drti_common_rmg_20200117_included
 #define drti_common_rmg_20200117_included
 
+#include <cstdint>
 #include <functional>
 
 namespace llvm
 {
+    class Argument;
+    class CallBase;
+    class DataLayout;
+    class LoadInst;
     class Module;
     class GlobalVariable;
 }
 
 namespace drti
 {
+    //! Whether code other than loads from the constant could depend
+    //! on its address, in which case it has to keep the address from
+    //! ahead-of-time compilation
+    bool constant_address_escapes(const llvm::GlobalVariable&);
+
+    //! Whether an argument gets value profiling on landing. The first
+    //! profiled_args of these in each function go in treenode::args
+    bool is_profiled_argument(const llvm::Argument&);
+
+    //! For a C++ virtual function call, returns the load of the
+    //! vtable pointer from the receiver object, otherwise null
+    llvm::LoadInst* virtual_call_vtable(llvm::CallBase&);
+
+    //! For a call matched by virtual_call_vtable, the byte offset of
+    //! the function pointer from the vtable's address point
+    int64_t virtual_call_offset(llvm::CallBase&, const llvm::DataLayout&);
+
     //! Visit the global variables from a module that need address
     //! equivalence between ahead-of-time compiled code and JIT code
     void visit_listed_globals(
@@ -0,0 +1,161 @@
+// -*- mode:c++ -*-
+//
+// Module drti-metrics.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// DRTI is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Prints the statistics that a program running with DRTI_METRICS
+// set publishes, without stopping it. Usage:
+//
+//   drti-metrics PID [INTERVAL_SECONDS]
+//
+// With an interval it prints the statistics repeatedly until the
+// program exits.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "metrics.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const drti::metrics_segment* open_segment(pid_t pid)
+{
+    std::string name(drti::metrics_segment_name(pid));
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+    {
+        std::cerr
+            << "drti-metrics: no segment " << name
+            << " (is the program running with DRTI_METRICS set?)\n";
+        return nullptr;
+    }
+
+    void* address = mmap(
+        nullptr, sizeof(drti::metrics_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(address == MAP_FAILED)
+    {
+        std::cerr << "drti-metrics: unable to map " << name << "\n";
+        return nullptr;
+    }
+
+    auto segment = static_cast<const drti::metrics_segment*>(address);
+    if(segment->magic != drti::metrics_magic)
+    {
+        std::cerr << "drti-metrics: " << name << " is not ready\n";
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(segment->layout != drti::metrics_layout)
+    {
+        std::cerr
+            << "drti-metrics: " << name
+            << " has layout " << segment->layout
+            << " but this reader expects " << drti::metrics_layout << "\n";
+        return nullptr;
+    }
+
+    return segment;
+}
+
+static void print_histogram(const char* name, const drti::histogram& durations)
+{
+    int64_t count = durations.count;
+    std::cout
+        << name << ".count " << count << "\n"
+        << name << ".total_us " << (durations.total_ns / 1000) << "\n";
+
+    for(int bucket = 0; bucket < drti::histogram::buckets; ++bucket)
+    {
+        if(int64_t in_bucket = durations.counts[bucket])
+        {
+            std::cout
+                << name << ".under_" << (int64_t(2) << bucket) << "us "
+                << in_bucket << "\n";
+        }
+    }
+}
+
+static void print_segment(const drti::metrics_segment& segment)
+{
+    std::cout
+        << "pid " << segment.pid << "\n"
+        << "nodes_discovered " << segment.nodes_discovered << "\n"
+        << "compiles_requested " << segment.compiles_requested << "\n"
+        << "compiles_installed " << segment.compiles_installed << "\n"
+        << "compiles_failed " << segment.compiles_failed << "\n"
+        << "compiles_discarded " << segment.compiles_discarded << "\n"
+        << "deoptimizations " << segment.deoptimizations << "\n"
+        << "jit_bytes " << segment.jit_bytes << "\n"
+        << "guard_hits " << segment.guard_hits << "\n"
+        << "guard_misses " << segment.guard_misses << "\n"
+        << "bitcode_parsed " << segment.bitcode_parsed << "\n"
+        << "compiled_instructions " << segment.compiled_instructions << "\n";
+
+    print_histogram("compile_time", segment.compile_time);
+    for(int phase = 0;
+        phase < static_cast<int>(drti::compile_phase::count);
+        ++phase)
+    {
+        std::string name(
+            drti::compile_phase_name(static_cast<drti::compile_phase>(phase)));
+        print_histogram(("phase." + name).c_str(), segment.phase_time[phase]);
+    }
+    print_histogram("time_to_install", segment.time_to_install);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: drti-metrics PID [INTERVAL_SECONDS]\n";
+        return 2;
+    }
+
+    pid_t pid = atoi(argv[1]);
+    int interval = argc > 2 ? atoi(argv[2]) : 0;
+
+    const drti::metrics_segment* segment = open_segment(pid);
+    if(!segment)
+    {
+        return 1;
+    }
+
+    print_segment(*segment);
+
+    // The mapping stays valid after the program unlinks the segment
+    // at exit, so check whether it's still running
+    while(interval > 0 && kill(pid, 0) == 0)
+    {
+        sleep(interval);
+        std::cout << "\n";
+        print_segment(*segment);
+    }
+
+    return 0;
+}
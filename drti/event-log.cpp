@@ -0,0 +1,308 @@
+// -*- mode:c++ -*-
+//
+// Module event-log.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// DRTI is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "event-log.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr size_t ring_size = 4096;
+
+    //! Events from one thread, with a single writer (the owning
+    //! thread) and a single reader (whoever holds EventLog::mutex)
+    struct EventRing
+    {
+        //! Number of events ever written
+        std::atomic<uint64_t> head{0};
+        //! Number of events ever read
+        std::atomic<uint64_t> tail{0};
+        //! Events lost because the reader fell behind
+        std::atomic<uint64_t> dropped{0};
+        //! Cleared when the owning thread exits, so another thread
+        //! can take the ring over
+        std::atomic<bool> in_use{true};
+        drti::event slots[ring_size];
+    };
+
+    struct EventLog
+    {
+        //! Protects rings and serialises readers
+        std::mutex mutex;
+        //! Never freed, since the rings outlive their threads
+        std::vector<EventRing*> rings;
+        std::ofstream file;
+        std::ostream* output = &std::cerr;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+    };
+
+    EventLog& event_log()
+    {
+        // Leaked so the drainer thread can keep running during exit
+        static EventLog* instance = new EventLog;
+        return *instance;
+    }
+
+    void drain_forever()
+    {
+        for(;;)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            drti::flush_events();
+        }
+    }
+
+    void start_drainer()
+    {
+        EventLog& log(event_log());
+
+        if(const char* path = getenv("DRTI_EVENT_LOG"))
+        {
+            log.file.open(path, std::ios::app);
+            if(log.file)
+            {
+                log.output = &log.file;
+            }
+        }
+
+        std::thread(drain_forever).detach();
+        std::atexit(drti::flush_events);
+    }
+
+    EventRing* claim_ring()
+    {
+        static std::once_flag started;
+        std::call_once(started, start_drainer);
+
+        EventLog& log(event_log());
+        std::lock_guard<std::mutex> lock(log.mutex);
+
+        for(EventRing* ring: log.rings)
+        {
+            bool expected = false;
+            if(ring->in_use.compare_exchange_strong(expected, true))
+            {
+                return ring;
+            }
+        }
+
+        log.rings.push_back(new EventRing);
+        return log.rings.back();
+    }
+
+    //! Gives each thread its own ring, released when the thread exits
+    struct ThreadRing
+    {
+        EventRing* ring = nullptr;
+        //! Set once the ring is handed back. Other thread_local
+        //! destructors can still log after ours has run, and their
+        //! events are dropped rather than written to a ring that
+        //! another thread may have claimed
+        bool released = false;
+
+        ~ThreadRing()
+        {
+            EventRing* owned = ring;
+            ring = nullptr;
+            released = true;
+            if(owned)
+            {
+                owned->in_use = false;
+            }
+        }
+    };
+
+    thread_local ThreadRing thread_ring;
+
+    void write_event(std::ostream& output, const drti::event& event)
+    {
+        // Formatted separately so the precision doesn't stick to
+        // output, which is usually std::cerr
+        std::ostringstream line;
+        line
+            << "DRTI "
+            << std::fixed << std::setprecision(6)
+            << (event.time * 1e-9)
+            << " "
+            << drti::event_type_name(event.type);
+
+        if(event.function)
+        {
+            line << " " << event.function;
+        }
+        if(event.target)
+        {
+            line << " -> " << event.target;
+        }
+        if(event.detail)
+        {
+            line << " " << event.detail;
+        }
+        if(event.value)
+        {
+            line << " [" << event.value << "]";
+        }
+        if(event.subject)
+        {
+            line << " (node " << event.subject << ")";
+        }
+
+        line << "\n";
+        output << line.str();
+    }
+
+    //! Releases what the event owns, once written out or dropped
+    void discard_event(const drti::event& event)
+    {
+        if(event.type == drti::event_type::message)
+        {
+            delete[] event.detail;
+        }
+    }
+}
+
+void drti::log_event(
+    event_type type,
+    const void* subject,
+    const char* function,
+    const char* target,
+    const char* detail,
+    int64_t value)
+{
+    event recorded{
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - event_log().start).count(),
+        type,
+        subject,
+        function,
+        target,
+        detail,
+        value};
+
+    if(!thread_ring.ring)
+    {
+        if(thread_ring.released)
+        {
+            discard_event(recorded);
+            return;
+        }
+        thread_ring.ring = claim_ring();
+    }
+    EventRing& ring(*thread_ring.ring);
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if(head - ring.tail.load(std::memory_order_acquire) >= ring_size)
+    {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        discard_event(recorded);
+        return;
+    }
+
+    ring.slots[head % ring_size] = recorded;
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void drti::log_message(const std::string& text, const void* subject)
+{
+    char* copy = new char[text.size() + 1];
+    std::memcpy(copy, text.c_str(), text.size() + 1);
+    log_event(event_type::message, subject, nullptr, nullptr, copy);
+}
+
+void drti::flush_events()
+{
+    EventLog& log(event_log());
+    std::lock_guard<std::mutex> lock(log.mutex);
+
+    bool wrote = false;
+    for(EventRing* ring: log.rings)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+
+        for(; tail != head; ++tail)
+        {
+            const event& recorded(ring->slots[tail % ring_size]);
+            write_event(*log.output, recorded);
+            discard_event(recorded);
+            wrote = true;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        if(uint64_t dropped = ring->dropped.exchange(0))
+        {
+            *log.output << "DRTI dropped " << dropped << " events\n";
+            wrote = true;
+        }
+    }
+
+    if(wrote)
+    {
+        log.output->flush();
+    }
+}
+
+const char* drti::event_type_name(event_type type)
+{
+    switch(type)
+    {
+        case event_type::node_discovered:
+            return "node_discovered";
+        case event_type::module_parsed:
+            return "module_parsed";
+        case event_type::compile_queued:
+            return "compile_queued";
+        case event_type::compile_started:
+            return "compile_started";
+        case event_type::compile_finished:
+            return "compile_finished";
+        case event_type::phase_finished:
+            return "phase_finished";
+        case event_type::compiled_size:
+            return "compiled_size";
+        case event_type::installed:
+            return "installed";
+        case event_type::failed:
+            return "failed";
+        case event_type::evicted:
+            return "evicted";
+        case event_type::deoptimized:
+            return "deoptimized";
+        case event_type::message:
+            return "message";
+    }
+    return "unknown";
+}
@@ -0,0 +1,111 @@
+// -*- mode:c++ -*-
+//
+// Header file event-log.hpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// DRTI is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Structured runtime events, recorded without locks or I/O by the
+// application threads and written out by a background thread
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef event_log_rmg_20261018_included
+#define event_log_rmg_20261018_included
+
+#include <cstdint>
+#include <string>
+
+namespace drti
+{
+    enum class event_type : uint8_t
+    {
+        //! A call chain landed in a decorated function for the first
+        //! time
+        node_discovered,
+        //! A module's bitcode was parsed, value is its size
+        module_parsed,
+        //! The node's compile_state changed
+        compile_queued,
+        compile_started,
+        //! The compiler produced machine code, value is the time
+        //! taken in nanoseconds
+        compile_finished,
+        //! One part of a compilation finished, detail is the
+        //! compile_phase name and value the time taken in nanoseconds
+        phase_finished,
+        //! value is the compiled function's IR instruction count
+        //! after optimization
+        compiled_size,
+        installed,
+        //! value is the failure_reason
+        failed,
+        evicted,
+        //! Installed code was uninstalled, value is the number of
+        //! times for the same node
+        deoptimized,
+        //! An error or trace message, detail is the text, which the
+        //! event log owns
+        message
+    };
+
+    //! One fixed-size record in the event log. The strings must have
+    //! static lifetime, like the names in landing_site, except for the
+    //! detail of a message
+    struct event
+    {
+        //! Nanoseconds on the steady clock
+        int64_t time;
+        event_type type;
+        //! The treenode concerned, if any
+        const void* subject;
+        //! Usually the function containing the call site
+        const char* function;
+        //! Usually the function the call landed in
+        const char* target;
+        //! Optional explanation, e.g. a failure reason
+        const char* detail;
+        //! Call number, size, duration or reason depending on type
+        int64_t value;
+    };
+
+    //! Records an event in the calling thread's ring buffer. Never
+    //! blocks, and drops the event if the buffer is full
+    void log_event(
+        event_type,
+        const void* subject,
+        const char* function,
+        const char* target = nullptr,
+        const char* detail = nullptr,
+        int64_t value = 0);
+
+    //! Records free text as an event_type::message. The text is
+    //! copied, so it needn't outlive the call, and only the thread
+    //! draining the log writes it out
+    void log_message(const std::string& text, const void* subject = nullptr);
+
+    //! Writes out every event recorded so far. Runs periodically on
+    //! a background thread and at exit
+    void flush_events();
+
+    //! Printable name of an event_type
+    const char* event_type_name(event_type);
+}
+
+#endif // event_log_rmg_20261018_included
@@ -0,0 +1,134 @@
+// -*- mode:c++ -*-
+//
+// Module metrics.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// DRTI is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "metrics.hpp"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::string drti::metrics_segment_name(pid_t pid)
+{
+    return "/drti-metrics." + std::to_string(pid);
+}
+
+static void unlink_segment()
+{
+    shm_unlink(drti::metrics_segment_name(getpid()).c_str());
+}
+
+static drti::metrics_segment* create_segment()
+{
+    if(!getenv("DRTI_METRICS"))
+    {
+        return nullptr;
+    }
+
+    std::string name(drti::metrics_segment_name(getpid()));
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0)
+    {
+        std::cerr << "DRTI unable to create metrics segment " << name << "\n";
+        return nullptr;
+    }
+
+    void* address = MAP_FAILED;
+    if(ftruncate(fd, sizeof(drti::metrics_segment)) == 0)
+    {
+        address = mmap(
+            nullptr, sizeof(drti::metrics_segment),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if(address == MAP_FAILED)
+    {
+        std::cerr << "DRTI unable to map metrics segment " << name << "\n";
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    // The new segment is zero filled, which is a valid initial state
+    // for the counters
+    auto segment = new(address) drti::metrics_segment;
+    segment->pid = getpid();
+    segment->layout = drti::metrics_layout;
+    // Readers check this last
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = drti::metrics_magic;
+
+    std::atexit(unlink_segment);
+    return segment;
+}
+
+drti::metrics_segment* drti::metrics()
+{
+    static metrics_segment* segment = create_segment();
+    return segment;
+}
+
+void drti::record(histogram& durations, int64_t nanoseconds)
+{
+    int bucket = 0;
+    for(int64_t micros = nanoseconds / 1000;
+        micros > 1 && bucket < histogram::buckets - 1;
+        micros >>= 1)
+    {
+        ++bucket;
+    }
+
+    durations.count.fetch_add(1, std::memory_order_relaxed);
+    durations.total_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+    durations.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+const char* drti::compile_phase_name(compile_phase phase)
+{
+    switch(phase)
+    {
+        case compile_phase::jit_create:
+            return "jit_create";
+        case compile_phase::parse:
+            return "parse";
+        case compile_phase::prepare_globals:
+            return "prepare_globals";
+        case compile_phase::link:
+            return "link";
+        case compile_phase::reprocess:
+            return "reprocess";
+        case compile_phase::optimize:
+            return "optimize";
+        case compile_phase::codegen:
+            return "codegen";
+        case compile_phase::install:
+            return "install";
+        case compile_phase::count:
+            break;
+    }
+    return "unknown";
+}
@@ -0,0 +1,134 @@
+// -*- mode:c++ -*-
+//
+// Header file metrics.hpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// DRTI is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Runtime statistics published in shared memory, so that another
+// process (see drti-metrics.cpp) can read them while the program
+// runs
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef metrics_rmg_20261018_included
+#define metrics_rmg_20261018_included
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+namespace drti
+{
+    //! "DRTI" in the first four bytes of a segment
+    constexpr uint32_t metrics_magic = 0x49545244;
+    //! Changes whenever metrics_segment changes
+    constexpr uint32_t metrics_layout = 2;
+
+    using metric_t = std::atomic<int64_t>;
+    static_assert(
+        metric_t::is_always_lock_free,
+        "metrics must be usable across processes");
+
+    //! Durations in power-of-two buckets, starting from bucket 0 for
+    //! anything under two microseconds
+    struct histogram
+    {
+        static constexpr int buckets = 32;
+
+        metric_t count;
+        metric_t total_ns;
+        metric_t counts[buckets];
+    };
+
+    //! The parts of a compilation that are timed separately
+    enum class compile_phase : int
+    {
+        //! Creating the LLJIT instance
+        jit_create,
+        //! Parsing one module's embedded bitcode
+        parse,
+        //! Checking the addresses of the globals that the modules use
+        prepare_globals,
+        //! Linking the leaf modules into the caller's
+        link,
+        //! Rewriting call sites into guarded direct calls
+        reprocess,
+        optimize,
+        //! Machine code generation, which the JIT does on lookup
+        codegen,
+        //! Checking the code is still valid and retargeting calls
+        install,
+        count
+    };
+
+    //! The shared memory segment. All counters are totals since the
+    //! program started
+    struct metrics_segment
+    {
+        uint32_t magic;
+        uint32_t layout;
+        int64_t pid;
+
+        //! Call chains that landed in a decorated function
+        metric_t nodes_discovered;
+        //! Nodes queued for compilation
+        metric_t compiles_requested;
+        //! Compilations whose code was installed
+        metric_t compiles_installed;
+        //! Compilations that failed or were refused
+        metric_t compiles_failed;
+        //! Compilations whose code was discarded before installing
+        metric_t compiles_discarded;
+        //! Installed code later uninstalled
+        metric_t deoptimizations;
+        //! Machine code and data loaded by the JIT
+        metric_t jit_bytes;
+        //! Hits and misses over all the guards in installed code.
+        //! Sampled periodically, so they lag a little
+        metric_t guard_hits;
+        metric_t guard_misses;
+        //! Bitcode parsed for compilations, in bytes
+        metric_t bitcode_parsed;
+        //! IR instructions in the compiled functions after
+        //! optimization
+        metric_t compiled_instructions;
+
+        histogram compile_time;
+        histogram phase_time[static_cast<int>(compile_phase::count)];
+        //! From the first inspect_treenode call for a node until code
+        //! compiled for it is installed
+        histogram time_to_install;
+    };
+
+    //! The segment name for the given process, for shm_open
+    std::string metrics_segment_name(pid_t);
+
+    //! This process's segment, created on first use if the
+    //! DRTI_METRICS environment variable is set, or null
+    metrics_segment* metrics();
+
+    void record(histogram&, int64_t nanoseconds);
+
+    //! Printable name of a compile_phase
+    const char* compile_phase_name(compile_phase);
+}
+
+#endif // metrics_rmg_20261018_included
@@ -23,47 +23,388 @@
 // 2019/11/25   rmg     File creation
 //
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/InlineCost.h"
 #include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Object/SymbolSize.h"
 #include "llvm/Support/TargetSelect.h"
-#include "llvm/Support/raw_os_ostream.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include <drti/runtime.hpp>
 #include <drti/drti-common.hpp>
+#include <drti/event-log.hpp>
+#include <drti/metrics.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+//! Collects the text of one error or trace message and records it
+//! in the event log at the end of the statement, so that application
+//! threads never write to stderr themselves. Use as
+//! LogMessage() << ... << ...;
+class LogMessage
+{
+public:
+    explicit LogMessage(const void* subject = nullptr): m_subject(subject)
+    {
+    }
+
+    ~LogMessage()
+    {
+        drti::log_message(m_text.str(), m_subject);
+    }
+
+    template<typename T>
+    LogMessage& operator<<(const T& value)
+    {
+        m_text << value;
+        return *this;
+    }
+
+private:
+    const void* m_subject;
+    std::ostringstream m_text;
+};
+
+//! Records a printout of IR, which the printer pass writes to a stream
+template<typename Print>
+static void log_ir(Print&& print)
+{
+    std::string text;
+    llvm::raw_string_ostream stream(text);
+    print(stream);
+    stream.flush();
+    drti::log_message(text);
+}
 
-#include <iostream>
+//! Where the node's calls land, or null if none has landed yet or
+//! the runtime wants the next call to come back to inspect_treenode
+static drti::landing_site* landing_of(const drti::treenode* node)
+{
+    return atomic_load_explicit(&node->landing, memory_order_acquire);
+}
 
-static std::ostream& log_stream(std::cerr);
+//! Makes the next call via the node come back to inspect_treenode
+static void clear_landing(drti::treenode* node)
+{
+    atomic_store_explicit(&node->landing, nullptr, memory_order_release);
+}
 
 namespace drti
 {
-    struct InternalCompilerError { };
+    struct InternalCompilerError
+    {
+        failure_reason reason;
+        //! The function whose bitcode we couldn't use, or the
+        //! function that a leaf couldn't be inlined into
+        const landing_site* caller = nullptr;
+        //! The leaf, for failures specific to one call
+        const landing_site* leaf = nullptr;
+    };
 
     enum log_level : int { fatal, error, warn, info, trace, debug };
     struct runtime_config
     {
         int log_level = log_level::info;
+        //! Maximum number of levels of calls inlined into a single
+        //! recompiled function, e.g. 2 for A+ from A* -> B* -> C*
+        int max_inline_depth = 4;
+        //! Maximum total bitcode size parsed for a single compilation
+        size_t max_inline_bytes = 16 << 20;
+        //! Maximum number of call sites inlined in any one function
+        int max_inline_callsites = 8;
+        //! Maximum number of targets inlined at any one call site
+        int max_polymorphic_targets = 3;
+        //! Call sites with more than this many targets are left alone
+        int megamorphic_targets = 8;
+        //! Percentage of guard misses that triggers deoptimization
+        int deopt_miss_percent = 50;
+        //! Number of deoptimizations after which we give up
+        //! recompiling a call chain
+        int max_deopts = 3;
+        //! Calls to observe with the original code after a
+        //! deoptimization before recompiling
+        int reprofile_calls = 1000;
+        //! Calls via a node needed before specialising on an argument
+        //! value. Compiling a chain with a possibly stable argument
+        //! waits until then, since the recompiled code stops profiling
+        int min_arg_samples = housekeeping_interval;
+        //! Percentage of landings with the same pointer argument
+        //! value needed to specialise on it
+        int stable_arg_percent = 90;
+        //! Assume that every module defining classes is decorated, so
+        //! that virtual calls with only one loaded implementation can
+        //! go direct without a guard
+        int whole_program = 0;
+        //! Seconds before trying again to compile something that
+        //! failed, or zero to never try again
+        int failure_retry_seconds = 0;
+        //! 1 to list compiled code in /tmp/perf-PID.map for perf,
+        //! 2 to also write a jitdump file if LLVM has perf support
+        int perf_map = 0;
+        //! Register compiled code with gdb's JIT interface
+        int gdb_jit = 0;
     };
 
+    runtime_config config_from_environment();
     bool abi_ok(int caller_abi);
     void maybe_log_treenode(treenode* node);
     void maybe_log_error(
         const landing_site&, const char* context, const char* message);
     void compile_treenode(treenode* node);
+    bool transition(
+        treenode*,
+        compile_state from,
+        compile_state to,
+        const char* detail = nullptr);
+    void evict(treenode*);
+    void record_failure(const InternalCompilerError&);
+    metrics_segment* shared_metrics();
+    bool known_failure(const landing_site& caller);
+    bool known_failure(const landing_site& caller, const landing_site& leaf);
+
+    struct GuardCounters;
+    void check_guard(GuardCounters&);
+    void deoptimize(GuardCounters&);
+    bool still_reprofiling(treenode*);
+    bool awaiting_arg_samples(treenode*);
+    bool deopt_limit_reached(const treenode*);
+    bool frozen_epoch(const void* address, size_t size, int64_t& epoch);
+    void invalidate(struct Specialisation&, const char* why);
+    bool sole_implementation(
+        const std::string& className,
+        int64_t offset,
+        const void* target,
+        int64_t& generation);
+
+    runtime_config config = config_from_environment();
+
+    //! One recompiled function installed as a resolved_target
+    struct Specialisation
+    {
+        //! The node whose resolved_target we set
+        treenode* const installed_at;
+        //! The node whose call chain was compiled, a child of
+        //! installed_at
+        treenode* const compiled;
+        //! The node passed to inspect_treenode, which is compiled or
+        //! a descendant of it, and whose compile_state we track
+        treenode* const trigger;
+        //! The machine code address we installed
+        const void* address = nullptr;
+        //! Set once we have put back the original target
+        bool deoptimized = false;
+        std::vector<std::unique_ptr<GuardCounters>> guards;
+        //! The LoadedClasses::generation that devirtualised calls in
+        //! the code rely on, or -1 if there are none
+        int64_t classes_generation = -1;
+        //! Virtual calls made direct without a guard
+        int devirtualised_calls = 0;
+        //! Arguments that guards check for a stable value
+        int specialised_args = 0;
+        //! Frozen ranges whose values the code uses, as (start,
+        //! FrozenRange::epoch) pairs
+        std::vector<std::pair<const void*, int64_t>> frozen;
+    };
+
+    //! log2 of the number of hit counters per guard
+    constexpr int guard_hit_shard_bits = 4;
+
+    //! One of a guard's hit counters, padded to a cache line
+    struct GuardHitShard
+    {
+        counter_t count = 0;
+        char padding[64 - sizeof(counter_t)];
+    };
+
+    //! Hit and miss counts for the guard at one reprocessed call
+    //! site, updated directly by the JIT-compiled code. Every call
+    //! that passes the guard counts a hit, so the hits are spread
+    //! over several cache lines chosen by the calling thread's stack
+    //! address, and threads running the same code don't keep taking
+    //! the line from each other. Misses are rare while the guard is
+    //! worth keeping, so they share one counter
+    struct GuardCounters
+    {
+        GuardHitShard hits[1 << guard_hit_shard_bits];
+        counter_t misses = 0;
+        Specialisation& owner;
+        //! The call tree context and call site that the guard covers
+        treenode* const context;
+        const static_callsite& callsite;
+        //! The counts at the previous check, so that each check judges
+        //! only the calls since then. Requires deopt_mutex
+        int64_t checked_hits = 0;
+        int64_t checked_misses = 0;
+
+        int64_t total_hits() const;
+    };
+
+    //! Call tree nodes from one call site in one context which are
+    //! observed again with the original code after a deoptimization.
+    //! Their landing pointers are cleared so that every call reaches
+    //! inspect_treenode until the window closes
+    struct Reprofile
+    {
+        std::unordered_map<treenode*, landing_site*> saved_landings;
+    };
+
+    //! Protects the deoptimization state below, which changes rarely
+    std::mutex deopt_mutex;
+    //! How many times we have deoptimized code installed at a node
+    std::unordered_map<const treenode*, int> deopt_history;
+    //! Keyed by the (context, call site) pair of a failed guard
+    std::map<std::pair<const treenode*, const static_callsite*>, Reprofile>
+        reprofiling;
+    //! Every guard in code that was ever installed, for the metrics
+    std::vector<const GuardCounters*> installed_guards;
+    //! Totals over all the code ever installed, for guards_installed
+    //! and calls_devirtualised
+    counter_t total_guards_installed = 0;
+    counter_t total_calls_devirtualised = 0;
+    counter_t total_arguments_specialised = 0;
+
+    //! Protects discovery_times
+    std::mutex discovery_mutex;
+    //! When each node was first inspected, kept until code for it is
+    //! installed, for the time_to_install histogram
+    std::unordered_map<const treenode*, std::chrono::steady_clock::time_point>
+        discovery_times;
+
+    //! Protects install_sites_busy
+    std::mutex install_sites_mutex;
+    //! The installed_at nodes that a thread is compiling code for.
+    //! Different triggers can share one, for instance descendants of
+    //! the same top or tops from sibling call sites, and we compile
+    //! for each installed_at one at a time so that the compiles don't
+    //! duplicate work and overwrite each other's resolved_target
+    std::unordered_set<const treenode*> install_sites_busy;
+
+    //! Claims an installed_at node for one compile, releasing it on
+    //! destruction even if the compile throws
+    class InstallSiteClaim
+    {
+    public:
+        explicit InstallSiteClaim(const treenode* installed_at);
+        ~InstallSiteClaim();
+
+        InstallSiteClaim(const InstallSiteClaim&) = delete;
+        InstallSiteClaim& operator=(const InstallSiteClaim&) = delete;
+
+        //! False if another thread is already compiling for the node
+        explicit operator bool() const { return m_claimed; }
+
+    private:
+        const treenode* m_installed_at;
+        bool m_claimed;
+    };
+
+    //! Records the time from construction to destruction against one
+    //! phase of compilation
+    class PhaseTimer
+    {
+    public:
+        PhaseTimer(
+            compile_phase, const treenode* subject, const char* function);
+        ~PhaseTimer();
+
+    private:
+        compile_phase m_phase;
+        const treenode* m_subject;
+        const char* m_function;
+        std::chrono::steady_clock::time_point m_started;
+    };
+
+    //! The modules that have called register_module, and the code
+    //! that relies on their vtables being all there is
+    struct LoadedClasses
+    {
+        std::mutex mutex;
+        std::vector<const reflect*> modules;
+        //! Changes when a module brings new vtables
+        int64_t generation = 0;
+        //! Set if any vtable has a layout we didn't recognise
+        bool incomplete = false;
+        std::vector<Specialisation*> dependents;
+    };
 
-    runtime_config config;
+    LoadedClasses& loaded_classes();
+
+    //! A range of memory declared by freeze_range
+    struct FrozenRange
+    {
+        size_t size;
+        //! Distinguishes successive freezes of the same address
+        int64_t epoch;
+        std::vector<Specialisation*> dependents;
+    };
+
+    struct FrozenGlobals
+    {
+        std::mutex mutex;
+        //! Keyed by start address
+        std::map<const char*, FrozenRange> ranges;
+        int64_t next_epoch = 0;
+    };
+
+    FrozenGlobals& frozen_globals();
+
+    using failure_clock = std::chrono::steady_clock;
+
+    //! Compilations that failed in ways that would repeat, so we can
+    //! skip them without parsing any bitcode. Entries last for
+    //! config.failure_retry_seconds, or forever if that is zero
+    struct NegativeCache
+    {
+        std::mutex mutex;
+        //! Functions whose own bitcode can't be used
+        std::unordered_map<const landing_site*, failure_clock::time_point>
+            landings;
+        //! Leaves that can't be inlined into a given caller, keyed by
+        //! (caller, leaf, reason)
+        std::map<
+            std::tuple<const landing_site*, const landing_site*, failure_reason>,
+            failure_clock::time_point>
+            calls;
+        counter_t failures[static_cast<int>(failure_reason::count)] = {};
+        counter_t skipped = 0;
+    };
+
+    NegativeCache negative_cache;
 
     struct ReflectedModule
     {
@@ -71,12 +412,10 @@ namespace drti
 
         std::unique_ptr<llvm::Module> readModule(llvm::LLVMContext&);
         llvm::Function* callsite_function();
-        void globalsMap(
-            llvm::orc::SymbolMap& map,
-            llvm::orc::MangleAndInterner&,
-            //! Other module to check for function definitions (if we
-            //! have a definition we want to be able to recompile it)
-            llvm::Module& availableModule) const;
+        const void* globalAddress(llvm::StringRef name) const;
+        void prepareGlobals(
+            //! Receives the frozen ranges we folded
+            Specialisation&) const;
 
         landing_site& m_landing_site;
         reflect& m_self;
@@ -84,16 +423,35 @@ namespace drti
         llvm::Module* m_module;
     };
 
+    //! A call from a function being recompiled to a leaf function
+    //! that we want to inline, together with any onward calls from
+    //! the leaf that get inlined along with it
+    struct InlineEdge
+    {
+        //! The (callsite, target) pair for the call
+        treenode* node;
+        //! Bitcode for the leaf, i.e. node->landing
+        std::unique_ptr<ReflectedModule> leaf;
+        //! Calls from the leaf to be inlined recursively
+        std::vector<InlineEdge> onward;
+        //! Snapshot of node->chain_calls when the edge was selected
+        int64_t calls = 0;
+        //! Total calls from the same callsite in the same context,
+        //! i.e. including the other targets
+        int64_t site_calls = 0;
+    };
+
     //! Lookups using the global symbols stashed by the drti
     //! decorator. This allows recompiled code to resolve against the
     //! exact same addresses which is vital for (e.g.) static
-    //! initialisation guard variables.
+    //! initialisation guard variables. Symbols are only resolved
+    //! when the JIT asks for them, so functions that get linked in
+    //! for recompilation never reach us.
     class ReflectedGlobals : public llvm::orc::DefinitionGenerator
     {
     public:
         ReflectedGlobals(
-            const ReflectedModule&,
-            const ReflectedModule&,
+            const std::vector<const ReflectedModule*>&,
             llvm::orc::LLJIT&);
 
         llvm::Error tryToGenerate(
@@ -102,21 +460,59 @@ namespace drti
             const llvm::orc::SymbolLookupSet &LookupSet) override;
 
     private:
-        llvm::orc::SymbolMap m_globalsMap;
+        std::vector<const ReflectedModule*> m_modules;
+        //! Prefix the JIT adds to IR names, if any
+        char m_globalPrefix;
     };
 
     class TreenodeCompiler
     {
     public:
-        TreenodeCompiler(treenode* node);
+        TreenodeCompiler(treenode* node, treenode* trigger);
         void* compile();
+        bool install();
 
     private:
         std::unique_ptr<llvm::orc::LLJIT> createJit();
-        void linkModules();
-        void reprocess(llvm::Function*, ReflectedModule&, const static_callsite&);
-        void reprocess(llvm::CallBase* callInst, ReflectedModule& leaf);
-
+        InlineEdge createEdge(treenode* node, landing_site&, int depth);
+        std::vector<InlineEdge> selectEdges(
+            treenode* context, const landing_site& function, int depth);
+        void collectModules(
+            const InlineEdge&, std::vector<const ReflectedModule*>&) const;
+        void prepareLeaves(InlineEdge&);
+        void linkModules(InlineEdge&);
+        void reprocess(
+            llvm::Function*,
+            treenode* context,
+            const landing_site& landing,
+            std::vector<InlineEdge>&);
+        void reprocess(
+            llvm::CallBase* callInst, const std::vector<InlineEdge*>& arms);
+        llvm::CallBase* createDirectCall(
+            llvm::IRBuilder<>&, llvm::CallBase* callInst, const InlineEdge& arm);
+        const thunk_info* findThunk(const InlineEdge& arm) const;
+        llvm::Value* adjustReceiver(
+            llvm::IRBuilder<>&,
+            llvm::CallBase* callInst,
+            const InlineEdge& arm) const;
+        bool soleImplementation(llvm::CallBase*, const InlineEdge&);
+        void devirtualise(llvm::CallBase*, const InlineEdge&);
+        llvm::Constant* vtableConstant(const void* vtable) const;
+        void customise();
+        std::vector<std::pair<unsigned, const void*>> stableArguments(
+            const InlineEdge&, const llvm::CallBase* callInst);
+        llvm::Constant* argumentConstant(
+            const void* value, llvm::Type* type) const;
+        llvm::Value* atomicIncrement(llvm::IRBuilder<>&, counter_t& counter);
+        void countHit(llvm::IRBuilder<>&, GuardCounters&);
+        llvm::BasicBlock* createMissBlock(
+            GuardCounters&, llvm::BasicBlock* slowPath);
+        void markForRedecoration(
+            llvm::CallBase*, const static_callsite&, treenode* context);
+        void redecorate();
+        void redecorate(llvm::CallBase*, const llvm::MDNode&);
+
+        void indexConverters();
         llvm::Function* findConverter(
             llvm::Type* fromType, llvm::Type* toType) const;
 
@@ -129,7 +525,7 @@ namespace drti
         llvm::Value* argTypeMismatch(
             const llvm::Use& argUse,
             const llvm::Argument& parameter,
-            const llvm::Function& function) const;
+            const InlineEdge& arm) const;
 
         void optimize();
 
@@ -139,13 +535,73 @@ namespace drti
         llvm::orc::ThreadSafeContext::Lock m_lock;
         llvm::LLVMContext& m_context;
 
-        ReflectedModule m_leaf;
+        //! Bitcode bytes parsed so far, for config.max_inline_bytes
+        size_t m_bytes_parsed;
+        //! Functions already in the compilation, so we don't inline
+        //! recursively or link the same leaf twice
+        std::vector<const landing_site*> m_included;
+
         ReflectedModule m_caller;
+        //! The calls from m_caller to inline, one of which is
+        //! normally m_node
+        std::vector<InlineEdge> m_edges;
+
+        //! Must outlive the machine code, which refers to its guards
+        Specialisation m_specialisation;
+
+        //! Direct calls to member functions from arms that guard on
+        //! the receiver's vtable, with the vtable address
+        std::vector<std::pair<llvm::CallBase*, const void*>> m_customisable;
+
+        //! DRTI_CONVERTIBLE functions in the linked module, keyed by
+        //! (from, to) type
+        llvm::DenseMap<std::pair<llvm::Type*, llvm::Type*>, llvm::Function*>
+            m_converters;
 
         std::unique_ptr<llvm::orc::LLJIT> m_jit;
     };
 }
 
+static int env_int(const char* name, int fallback)
+{
+    const char* value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+drti::runtime_config drti::config_from_environment()
+{
+    runtime_config result;
+
+    result.log_level = env_int("DRTI_LOG_LEVEL", result.log_level);
+    result.max_inline_depth = env_int(
+        "DRTI_MAX_INLINE_DEPTH", result.max_inline_depth);
+    result.max_inline_bytes = env_int(
+        "DRTI_MAX_INLINE_BYTES", result.max_inline_bytes);
+    result.max_inline_callsites = env_int(
+        "DRTI_MAX_INLINE_CALLSITES", result.max_inline_callsites);
+    result.max_polymorphic_targets = env_int(
+        "DRTI_MAX_POLYMORPHIC_TARGETS", result.max_polymorphic_targets);
+    result.megamorphic_targets = env_int(
+        "DRTI_MEGAMORPHIC_TARGETS", result.megamorphic_targets);
+    result.deopt_miss_percent = env_int(
+        "DRTI_DEOPT_MISS_PERCENT", result.deopt_miss_percent);
+    result.max_deopts = env_int("DRTI_MAX_DEOPTS", result.max_deopts);
+    result.reprofile_calls = env_int(
+        "DRTI_REPROFILE_CALLS", result.reprofile_calls);
+    result.min_arg_samples = env_int(
+        "DRTI_MIN_ARG_SAMPLES", result.min_arg_samples);
+    result.stable_arg_percent = env_int(
+        "DRTI_STABLE_ARG_PERCENT", result.stable_arg_percent);
+    result.whole_program = env_int(
+        "DRTI_WHOLE_PROGRAM", result.whole_program);
+    result.failure_retry_seconds = env_int(
+        "DRTI_FAILURE_RETRY_SECONDS", result.failure_retry_seconds);
+    result.perf_map = env_int("DRTI_PERF_MAP", result.perf_map);
+    result.gdb_jit = env_int("DRTI_GDB_JIT", result.gdb_jit);
+
+    return result;
+}
+
 static int oneTimeInit()
 {
     llvm::InitializeNativeTarget();
@@ -169,12 +625,11 @@ bool drti::abi_ok(int caller_abi)
     {
         if(config.log_level >= log_level::error)
         {
-            log_stream
-                << "DRTI ABI mismatch client "
+            LogMessage()
+                << "ABI mismatch client "
                 << caller_abi
                 << " != runtime "
-                << abi_version
-                << std::endl;
+                << abi_version;
         }
         return false;
     }
@@ -184,7 +639,7 @@ bool drti::abi_ok(int caller_abi)
     }
 }
 
-#define HANDLE( LANDING, CONTEXT, ERROR )               \
+#define HANDLE( REASON, LANDING, CONTEXT, ERROR )       \
     do                                                  \
     {                                                   \
         llvm::handleAllErrors(                          \
@@ -194,29 +649,48 @@ bool drti::abi_ok(int caller_abi)
                     LANDING, CONTEXT,                   \
                     EIB.message().c_str() );            \
             });                                         \
-        throw InternalCompilerError();                  \
+        throw InternalCompilerError{                    \
+            failure_reason::REASON, &(LANDING)};        \
     } while(0)
 
-#define CHECK_WRAPPER( LANDING, CONTEXT, WRAPPER )      \
-    if(!WRAPPER)                                        \
-    {                                                   \
-        HANDLE(LANDING, CONTEXT, WRAPPER.takeError());  \
+#define CHECK_WRAPPER( REASON, LANDING, CONTEXT, WRAPPER )      \
+    if(!WRAPPER)                                                \
+    {                                                           \
+        HANDLE(REASON, LANDING, CONTEXT, WRAPPER.takeError());  \
     }
 
-#define CHECK_ERROR( LANDING, CONTEXT, ERROR )          \
-    if(ERROR)                                           \
-    {                                                   \
-        HANDLE(LANDING, CONTEXT, std::move(ERROR));     \
+#define CHECK_ERROR( REASON, LANDING, CONTEXT, ERROR )          \
+    if(ERROR)                                                   \
+    {                                                           \
+        HANDLE(REASON, LANDING, CONTEXT, std::move(ERROR));     \
     }
 
 void drti::maybe_log_treenode(treenode* node)
 {
+    const landing_site* landing = landing_of(node);
+    if(!landing)
+    {
+        // Cleared again by another thread
+        return;
+    }
+
     if(config.log_level >= log_level::info)
     {
-        log_stream << "DRTI ";
+        log_event(
+            event_type::node_discovered,
+            node,
+            node->location.landing.function_name,
+            landing->function_name,
+            nullptr,
+            node->location.call_number);
+    }
+
+    if(config.log_level >= log_level::trace)
+    {
+        LogMessage message(node);
         if(node->parent)
         {
-            log_stream
+            message
                 << node->parent->location.landing.total_called
                 << " * "
                 << node->parent->location.landing.global_name
@@ -225,10 +699,10 @@ void drti::maybe_log_treenode(treenode* node)
         }
         else
         {
-            log_stream << "(unknown)";
+            message << "(unknown)";
         }
 
-        log_stream
+        message
             << " -> "
             << node->location.landing.total_called
             << " * "
@@ -240,11 +714,10 @@ void drti::maybe_log_treenode(treenode* node)
             << " -> "
             << node->chain_calls
             << " * "
-            << node->landing->function_name
+            << landing->function_name
             << " ("
-            << node->landing->total_called
-            << " total)"
-            << std::endl;
+            << landing->total_called
+            << " total)";
     }
 }
 
@@ -253,14 +726,12 @@ void drti::maybe_log_error(
 {
     if(config.log_level >= log_level::error)
     {
-        log_stream
-            << "DRTI "
+        LogMessage()
             << landing.function_name
             << " "
             << context
             << " "
-            << message
-            << "\n";
+            << message;
     }
 }
 
@@ -271,6 +742,24 @@ void drti::inspect_treenode(treenode* node)
         return;
     }
 
+    if(awaiting_arg_samples(node) || still_reprofiling(node))
+    {
+        return;
+    }
+
+    if(node->parent)
+    {
+        // Several threads can land with the same caller at once, and
+        // only the one that queues the node compiles it
+        compile_state previous = atomic_load(&node->state);
+        if((previous != compile_state::unseen
+            && previous != compile_state::evicted)
+           || !transition(node, previous, compile_state::queued))
+        {
+            return;
+        }
+    }
+
     maybe_log_treenode(node);
 
     if(node->parent)
@@ -279,9 +768,169 @@ void drti::inspect_treenode(treenode* node)
         {
             compile_treenode(node);
         }
-        catch(const InternalCompilerError&)
+        catch(const InternalCompilerError& error)
+        {
+            record_failure(error);
+            transition(
+                node,
+                compile_state::compiling,
+                compile_state::failed,
+                failure_reason_name(error.reason));
+        }
+    }
+}
+
+const char* drti::compile_state_name(compile_state state)
+{
+    switch(state)
+    {
+        case compile_state::unseen:
+            return "unseen";
+        case compile_state::queued:
+            return "queued";
+        case compile_state::compiling:
+            return "compiling";
+        case compile_state::installed:
+            return "installed";
+        case compile_state::failed:
+            return "failed";
+        case compile_state::evicted:
+            return "evicted";
+    }
+    return "unknown";
+}
+
+//! Changes the node's compile_state if it is still from, returning
+//! false if it had already changed
+bool drti::transition(
+    treenode* node, compile_state from, compile_state to, const char* detail)
+{
+    if(!atomic_compare_exchange_strong(&node->state, &from, to))
+    {
+        return false;
+    }
+
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        if(from == compile_state::unseen)
+        {
+            ++metrics->nodes_discovered;
+
+            std::lock_guard<std::mutex> lock(discovery_mutex);
+            discovery_times.emplace(node, std::chrono::steady_clock::now());
+        }
+        else if(to == compile_state::installed)
+        {
+            std::lock_guard<std::mutex> lock(discovery_mutex);
+            auto found = discovery_times.find(node);
+            if(found != discovery_times.end())
+            {
+                record(
+                    metrics->time_to_install,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now()
+                        - found->second).count());
+                discovery_times.erase(found);
+            }
+        }
+
+        switch(to)
+        {
+            case compile_state::queued:
+                ++metrics->compiles_requested;
+                break;
+            case compile_state::installed:
+                ++metrics->compiles_installed;
+                break;
+            case compile_state::failed:
+                ++metrics->compiles_failed;
+                break;
+            case compile_state::evicted:
+                if(from == compile_state::compiling)
+                {
+                    ++metrics->compiles_discarded;
+                }
+                break;
+            case compile_state::unseen:
+            case compile_state::compiling:
+                break;
+        }
+    }
+
+    if(config.log_level >= log_level::info)
+    {
+        const landing_site* landing = landing_of(node);
+        event_type type = event_type::evicted;
+        switch(to)
         {
+            case compile_state::unseen:
+            case compile_state::evicted:
+                break;
+            case compile_state::queued:
+                type = event_type::compile_queued;
+                break;
+            case compile_state::compiling:
+                type = event_type::compile_started;
+                break;
+            case compile_state::installed:
+                type = event_type::installed;
+                break;
+            case compile_state::failed:
+                type = event_type::failed;
+                break;
         }
+
+        log_event(
+            type,
+            node,
+            node->location.landing.function_name,
+            landing ? landing->function_name : nullptr,
+            detail,
+            node->location.call_number);
+    }
+    return true;
+}
+
+drti::PhaseTimer::PhaseTimer(
+    compile_phase phase, const treenode* subject, const char* function) :
+
+    m_phase(phase),
+    m_subject(subject),
+    m_function(function),
+    m_started(std::chrono::steady_clock::now())
+{
+}
+
+drti::PhaseTimer::~PhaseTimer()
+{
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - m_started).count();
+
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        record(metrics->phase_time[static_cast<int>(m_phase)], elapsed);
+    }
+
+    if(config.log_level >= log_level::info)
+    {
+        log_event(
+            event_type::phase_finished,
+            m_subject,
+            m_function,
+            nullptr,
+            compile_phase_name(m_phase),
+            elapsed);
+    }
+}
+
+//! Lets a node that was compiled, or that failed to compile, be
+//! compiled again. Nodes being compiled by another thread are left
+//! alone
+void drti::evict(treenode* node)
+{
+    if(!transition(node, compile_state::installed, compile_state::evicted))
+    {
+        transition(node, compile_state::failed, compile_state::evicted);
     }
 }
 
@@ -300,6 +949,9 @@ std::unique_ptr<llvm::Module> drti::ReflectedModule::readModule(
 {
     assert(m_landing_site.self);
 
+    PhaseTimer timer(
+        compile_phase::parse, nullptr, m_landing_site.function_name);
+
     llvm::StringRef string(m_self.module, m_self.module_size);
 
     auto buffer(
@@ -317,16 +969,23 @@ std::unique_ptr<llvm::Module> drti::ReflectedModule::readModule(
     llvm::Expected<std::unique_ptr<llvm::Module>> maybeModule(
         llvm::parseBitcodeFile(*buffer, context));
 
-    CHECK_WRAPPER(m_landing_site, "parseBitcodeFile", maybeModule);
+    CHECK_WRAPPER(
+        llvm_error, m_landing_site, "parseBitcodeFile", maybeModule);
+
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        metrics->bitcode_parsed += m_self.module_size;
+    }
 
     if(config.log_level >= log_level::info)
     {
-        log_stream
-            << "DRTI module for "
-            << m_landing_site.function_name
-            << " of size "
-            << m_self.module_size
-            << "\n";
+        log_event(
+            event_type::module_parsed,
+            nullptr,
+            m_landing_site.function_name,
+            nullptr,
+            nullptr,
+            m_self.module_size);
     }
 
     return std::move(*maybeModule);
@@ -339,134 +998,332 @@ llvm::Function* drti::ReflectedModule::callsite_function()
     {
         if(config.log_level >= log_level::error)
         {
-            log_stream
-                << "DRTI "
+            LogMessage message;
+            message
                 << m_landing_site.function_name
-                << " not found in bitcode. Globals dump follows:\n";
+                << " not found in bitcode. Globals dump follows:";
 
             for(llvm::Function& function: m_module->functions())
             {
-                log_stream << "DRTI " << function.getName().str() << "\n";
+                message << "\nDRTI " << function.getName().str();
             }
             for(llvm::GlobalVariable& global: m_module->globals())
             {
-                log_stream << "DRTI " << global.getName().str() << "\n";
+                message << "\nDRTI " << global.getName().str();
             }
         }
-        throw InternalCompilerError();
+        throw InternalCompilerError{
+            failure_reason::missing_function, &m_landing_site};
     }
 
     return func;
 }
 
-void drti::ReflectedModule::globalsMap(
-    llvm::orc::SymbolMap& map,
-    llvm::orc::MangleAndInterner& mangler,
-    llvm::Module& availableModule) const
+//! A constant of the given type with the value currently in memory
+//! at address, or nullptr for types we don't handle
+static llvm::Constant* constantFromMemory(
+    llvm::Type* type, const char* address, const llvm::DataLayout& layout)
 {
-    // We must process these in exactly the same order as the code
-    // that populated the reflect.globals (see drti-decorate.cpp)
-    size_t index = 0;
-
-    auto addNext = [&](llvm::StringRef name) {
-        if(index >= m_self.globals_size)
+    if(auto integer = llvm::dyn_cast<llvm::IntegerType>(type))
+    {
+        uint64_t value = 0;
+        if(integer->getBitWidth() > 64)
+        {
+            return nullptr;
+        }
+        std::memcpy(&value, address, layout.getTypeStoreSize(type));
+        return llvm::ConstantInt::get(integer, value);
+    }
+    else if(type->isFloatTy())
+    {
+        float value;
+        std::memcpy(&value, address, sizeof(value));
+        return llvm::ConstantFP::get(type, value);
+    }
+    else if(type->isDoubleTy())
+    {
+        double value;
+        std::memcpy(&value, address, sizeof(value));
+        return llvm::ConstantFP::get(type, value);
+    }
+    else if(auto pointer = llvm::dyn_cast<llvm::PointerType>(type))
+    {
+        const void* value;
+        std::memcpy(&value, address, sizeof(value));
+        if(!value)
+        {
+            return llvm::ConstantPointerNull::get(pointer);
+        }
+        return llvm::ConstantExpr::getIntToPtr(
+            llvm::ConstantInt::get(
+                llvm::IntegerType::get(type->getContext(), 64),
+                reinterpret_cast<uintptr_t>(value)),
+            type);
+    }
+    else if(auto array = llvm::dyn_cast<llvm::ArrayType>(type))
+    {
+        llvm::Type* elementType = array->getElementType();
+        const uint64_t stride = layout.getTypeAllocSize(elementType);
+        std::vector<llvm::Constant*> elements;
+        for(uint64_t index = 0; index < array->getNumElements(); ++index)
+        {
+            elements.push_back(
+                constantFromMemory(
+                    elementType, address + index * stride, layout));
+            if(!elements.back())
+            {
+                return nullptr;
+            }
+        }
+        return llvm::ConstantArray::get(array, elements);
+    }
+    else if(auto structure = llvm::dyn_cast<llvm::StructType>(type))
+    {
+        const llvm::StructLayout* offsets = layout.getStructLayout(structure);
+        std::vector<llvm::Constant*> elements;
+        for(unsigned index = 0; index < structure->getNumElements(); ++index)
         {
-            if(config.log_level >= log_level::error)
+            elements.push_back(
+                constantFromMemory(
+                    structure->getElementType(index),
+                    address + offsets->getElementOffset(index),
+                    layout));
+            if(!elements.back())
             {
-                log_stream
-                    << "DRTI "
-                    << m_landing_site.function_name
-                    << " module has "
-                    << (index + 1)
-                    << " globals but only "
-                    << m_self.globals_size
-                    << " stored addresses\n";
+                return nullptr;
             }
-            throw InternalCompilerError();
         }
+        return llvm::ConstantStruct::get(structure, elements);
+    }
+    return nullptr;
+}
 
-        // TODO - check for invalid collisions
-        llvm::JITEvaluatedSymbol address(
-            reinterpret_cast<uintptr_t>(m_self.globals[index]),
-            llvm::JITSymbolFlags::Exported);
+//! If the variable lies within a frozen range, gives it an
+//! initializer with its current value and marks it constant so the
+//! optimizer can fold loads from it. It still resolves to the
+//! original address, like the other listed globals
+static bool foldFrozen(
+    llvm::GlobalVariable& variable,
+    const void* address,
+    drti::Specialisation& specialisation)
+{
+    if(variable.isThreadLocal())
+    {
+        return false;
+    }
 
-        llvm::orc::SymbolStringPtr symbol = mangler(name);
+    const llvm::DataLayout& layout(variable.getParent()->getDataLayout());
+    int64_t epoch;
+    if(!drti::frozen_epoch(
+           address, layout.getTypeAllocSize(variable.getValueType()), epoch))
+    {
+        return false;
+    }
 
-        if(config.log_level >= log_level::debug)
-        {
-            log_stream
-                << "DRTI "
-                << (*symbol).str()
-                << " runtime address "
-                << reinterpret_cast<const void*>(address.getAddress())
-                << "\n";
-        }
+    llvm::Constant* value = constantFromMemory(
+        variable.getValueType(), static_cast<const char*>(address), layout);
+    if(!value)
+    {
+        return false;
+    }
 
-        map[symbol] = address;
+    if(drti::config.log_level >= drti::log_level::debug)
+    {
+        LogMessage()
+            << "folding frozen "
+            << variable.getName().str();
+    }
 
-        ++index;
-    };
+    variable.setInitializer(value);
+    variable.setConstant(true);
+    variable.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    variable.setComdat(nullptr);
+    specialisation.frozen.emplace_back(address, epoch);
+    return true;
+}
 
-    visit_listed_globals(
-        *m_module,
-        [&addNext](llvm::GlobalVariable& variable) {
-            addNext(variable.getName());
-
-            // Force "internal" variables to resolve against the
-            // original copy compiled ahead-of-time and saved in the
-            // reflected globals list. This is essential for static
-            // initialisers to work and only be invoked once.
-            //
-            // TODO - we could add special handling for static
-            // initialisation guard variables and completely elide
-            // guard checks and init code for variables already
-            // initialised at JIT time. Actually in general some
-            // variables have only two states and we could convert
-            // them to compile-time constants given enough knowledge.
-            if(variable.hasLocalLinkage())
+using GuardValues =
+    std::unordered_map<const llvm::GlobalVariable*, const void*>;
+
+//! Checks for a C++ static initialisation guard variable whose
+//! initialisation has already completed. Once set the guard never
+//! changes again, so the recompiled code can treat it as a constant
+static bool isInitialisedGuard(
+    const llvm::GlobalVariable& variable, const void* address)
+{
+    // Itanium ABI guard variable names start with _ZGV, and the first
+    // byte of the guard is non-zero once initialisation is complete.
+    // Guards for thread_local variables vary between threads
+    return variable.getName().startswith("_ZGV")
+        && !variable.isThreadLocal()
+        && __atomic_load_n(
+            static_cast<const char*>(address), __ATOMIC_ACQUIRE) != 0;
+}
+
+//! Replaces integer loads from the given guard variables with their
+//! current values, which allows the optimizer to remove the guard
+//! checks and initialisation code
+static void foldGuardLoads(llvm::Module& module, const GuardValues& guards)
+{
+    if(guards.empty())
+    {
+        return;
+    }
+
+    const llvm::DataLayout& layout(module.getDataLayout());
+    std::vector<std::pair<llvm::LoadInst*, llvm::Constant*>> folds;
+
+    for(llvm::Function& function: module)
+    {
+        for(llvm::BasicBlock& block: function)
+        {
+            for(llvm::Instruction& instruction: block)
             {
-                variable.setLinkage(
-                    llvm::GlobalValue::AvailableExternallyLinkage);
+                auto load = llvm::dyn_cast<llvm::LoadInst>(&instruction);
+                if(!load || load->isVolatile())
+                {
+                    continue;
+                }
+
+                auto variable = llvm::dyn_cast<llvm::GlobalVariable>(
+                    load->getPointerOperand()->stripPointerCasts());
+                auto found = guards.find(variable);
+                auto type = llvm::dyn_cast<llvm::IntegerType>(load->getType());
+                if(found == guards.end() || !type)
+                {
+                    continue;
+                }
+
+                uint64_t size = layout.getTypeStoreSize(type);
+                if(size > sizeof(uint64_t)
+                   || size > layout.getTypeStoreSize(variable->getValueType()))
+                {
+                    continue;
+                }
+
+                uint64_t value = 0;
+                std::memcpy(&value, found->second, size);
+                folds.emplace_back(load, llvm::ConstantInt::get(type, value));
             }
+        }
+    }
+
+    for(auto& [load, value]: folds)
+    {
+        if(drti::config.log_level >= drti::log_level::debug)
+        {
+            LogMessage()
+                << "folding initialised guard "
+                << load->getPointerOperand()->stripPointerCasts()->getName().str()
+                << " in "
+                << load->getFunction()->getName().str();
+        }
+        load->replaceAllUsesWith(value);
+        load->eraseFromParent();
+    }
+}
+
+//! Finds the address recorded for a global variable or function
+//! that the bitcode refers to, using the index from the decorate
+//! pass. Returns nullptr if the module has no such symbol
+const void* drti::ReflectedModule::globalAddress(llvm::StringRef name) const
+{
+    const symbol_info* begin = m_self.symbols;
+    const symbol_info* end = begin + m_self.symbols_size;
+
+    const symbol_info* found = std::lower_bound(
+        begin, end, name,
+        [](const symbol_info& symbol, llvm::StringRef name) {
+            return llvm::StringRef(symbol.name) < name;
         });
 
-    for(llvm::Function& function: m_module->functions())
+    if(found == end || name != found->name)
     {
-        // IMPORTANT - filtering here must match the same functions as
-        // in collect_globals from drti-decorate.cpp
-        if(function.isDeclaration() && !function.isIntrinsic())
+        return nullptr;
+    }
+    else if(found->global >= m_self.globals_size)
+    {
+        if(config.log_level >= log_level::error)
         {
-            llvm::Function* found =
-                availableModule.getFunction(function.getName());
+            LogMessage()
+                << m_landing_site.function_name
+                << " module indexes global "
+                << found->global
+                << " but only has "
+                << m_self.globals_size
+                << " stored addresses";
+        }
+        return nullptr;
+    }
+
+    return m_self.globals[found->global];
+}
+
+//! Makes the listed global variables in the bitcode resolve against
+//! the original copies, folding any whose values are known
+void drti::ReflectedModule::prepareGlobals(
+    Specialisation& specialisation) const
+{
+    GuardValues initialised;
 
-            if(found && !found->isDeclaration())
+    visit_listed_globals(
+        *m_module,
+        [this, &initialised, &specialisation](
+            llvm::GlobalVariable& variable) {
+            const void* address = globalAddress(variable.getName());
+            if(!address)
             {
-                // We have a definition for this function so
-                // potentially want to recompile it at runtime, rather
-                // than resolving against a saved global address.
-                if(config.log_level >= log_level::debug)
+                if(config.log_level >= log_level::error)
                 {
-                    log_stream
-                        << "DRTI not mapping available function "
-                        << function.getName().str()
-                        << "\n";
+                    LogMessage()
+                        << m_landing_site.function_name
+                        << " module has no stored address for "
+                        << variable.getName().str();
                 }
+                throw InternalCompilerError{
+                    failure_reason::globals_mismatch, &m_landing_site};
             }
-            else
+
+            if(foldFrozen(variable, address, specialisation))
             {
-                addNext(function.getName());
+                return;
             }
-        }
-    }
+
+            // Force variables to resolve against the original copy
+            // compiled ahead-of-time and saved in the reflected
+            // globals list. This is essential for static initialisers
+            // to work and only be invoked once. Keeping the
+            // initializer lets the optimizer fold loads from
+            // constants whose address escapes
+            if(!variable.isDeclaration())
+            {
+                variable.setLinkage(
+                    llvm::GlobalValue::AvailableExternallyLinkage);
+                variable.setComdat(nullptr);
+            }
+
+            if(isInitialisedGuard(variable, address))
+            {
+                initialised[&variable] = address;
+            }
+        });
+
+    // The guarded variables themselves still resolve against the
+    // original copies above, we just skip checking and initialising
+    // them again
+    foldGuardLoads(*m_module, initialised);
 }
 
-drti::TreenodeCompiler::TreenodeCompiler(treenode* node) :
+drti::TreenodeCompiler::TreenodeCompiler(treenode* node, treenode* trigger) :
     m_node(node),
     m_thread_safe_context(llvmContext()),
     m_lock(m_thread_safe_context.getLock()),
     m_context(*m_thread_safe_context.getContext()),
-    m_leaf(m_context, *m_node->landing),
+    m_bytes_parsed(m_node->location.landing.self->module_size),
+    m_included(1, &m_node->location.landing),
     m_caller(m_context, m_node->location.landing),
+    m_edges(selectEdges(m_node->parent, m_node->location.landing, 1)),
+    m_specialisation{m_node->parent, m_node, trigger},
     m_jit(createJit())
 {
     llvm::orc::LLJIT& jit(*m_jit);
@@ -477,23 +1334,35 @@ drti::TreenodeCompiler::TreenodeCompiler(treenode* node) :
             llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
                 jit.getDataLayout().getGlobalPrefix())));
 
+    std::vector<const ReflectedModule*> modules(1, &m_caller);
+    for(const InlineEdge& edge: m_edges)
+    {
+        collectModules(edge, modules);
+    }
+
+    {
+        PhaseTimer timer(
+            compile_phase::prepare_globals,
+            m_node,
+            m_caller.m_landing_site.function_name);
+
+        for(const ReflectedModule* module: modules)
+        {
+            module->prepareGlobals(m_specialisation);
+        }
+    }
+
     jit.getMainJITDylib().addGenerator(
-        std::make_unique<ReflectedGlobals>(
-            m_leaf, m_caller, jit));
+        std::make_unique<ReflectedGlobals>(modules, jit));
 }
 
 drti::ReflectedGlobals::ReflectedGlobals(
-    const ReflectedModule& module1,
-    const ReflectedModule& module2,
+    const std::vector<const ReflectedModule*>& modules,
     llvm::orc::LLJIT& jit) :
 
-    m_globalsMap()
+    m_modules(modules),
+    m_globalPrefix(jit.getDataLayout().getGlobalPrefix())
 {
-    llvm::orc::MangleAndInterner mangler(
-        jit.getExecutionSession(), jit.getDataLayout());
-
-    module1.globalsMap(m_globalsMap, mangler, *module2.m_module);
-    module2.globalsMap(m_globalsMap, mangler, *module1.m_module);
 }
 
 llvm::Error drti::ReflectedGlobals::tryToGenerate(
@@ -505,19 +1374,34 @@ llvm::Error drti::ReflectedGlobals::tryToGenerate(
 
     for(auto const& pair: requested)
     {
-        auto found = m_globalsMap.find(pair.first);
-        if(found != m_globalsMap.end())
+        llvm::StringRef name(*pair.first);
+        if(m_globalPrefix && !name.consume_front(llvm::StringRef(&m_globalPrefix, 1)))
+        {
+            continue;
+        }
+
+        // TODO - check for invalid collisions
+        for(const ReflectedModule* module: m_modules)
         {
-            mapped.insert(*found);
+            const void* address = module->globalAddress(name);
+            if(!address)
+            {
+                continue;
+            }
+
+            mapped[pair.first] = llvm::JITEvaluatedSymbol(
+                reinterpret_cast<uintptr_t>(address),
+                llvm::JITSymbolFlags::Exported);
+
             if(config.log_level >= log_level::trace)
             {
-                log_stream
-                    << "DRTI resolved global "
+                LogMessage()
+                    << "resolved global "
                     << (*pair.first).str()
                     << " as "
-                    << reinterpret_cast<const void*>(found->second.getAddress())
-                    << "\n";
+                    << address;
             }
+            break;
         }
     }
 
@@ -531,8 +1415,111 @@ llvm::Error drti::ReflectedGlobals::tryToGenerate(
     }
 }
 
+namespace
+{
+    //! Sees every object file that the JIT loads
+    class JitListener : public llvm::JITEventListener
+    {
+    public:
+        void notifyObjectLoaded(
+            ObjectKey,
+            const llvm::object::ObjectFile& object,
+            const llvm::RuntimeDyld::LoadedObjectInfo& loaded) override
+        {
+            if(drti::metrics_segment* metrics = drti::shared_metrics())
+            {
+                int64_t bytes = 0;
+                for(const llvm::object::SectionRef& section: object.sections())
+                {
+                    if(loaded.getSectionLoadAddress(section))
+                    {
+                        bytes += section.getSize();
+                    }
+                }
+                metrics->jit_bytes += bytes;
+            }
+
+            if(drti::config.perf_map)
+            {
+                writePerfMap(object, loaded);
+            }
+        }
+
+    private:
+        //! Appends the functions in the object to /tmp/perf-PID.map,
+        //! in the "START SIZE name" format that perf reads
+        void writePerfMap(
+            const llvm::object::ObjectFile& object,
+            const llvm::RuntimeDyld::LoadedObjectInfo& loaded)
+        {
+            // The debug object has the symbols at their load addresses
+            llvm::object::OwningBinary<llvm::object::ObjectFile> relocated(
+                loaded.getObjectForDebug(object));
+            const llvm::object::ObjectFile* symbols =
+                relocated.getBinary() ? relocated.getBinary() : &object;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!m_perfMap.is_open())
+            {
+                m_perfMap.open(
+                    "/tmp/perf-" + std::to_string(getpid()) + ".map",
+                    std::ios::app);
+            }
+
+            for(const auto& [symbol, size]:
+                    llvm::object::computeSymbolSizes(*symbols))
+            {
+                llvm::Expected<llvm::object::SymbolRef::Type> type =
+                    symbol.getType();
+                if(!type)
+                {
+                    llvm::consumeError(type.takeError());
+                    continue;
+                }
+                if(*type != llvm::object::SymbolRef::ST_Function || !size)
+                {
+                    continue;
+                }
+
+                llvm::Expected<llvm::StringRef> name = symbol.getName();
+                if(!name)
+                {
+                    llvm::consumeError(name.takeError());
+                    continue;
+                }
+                llvm::Expected<uint64_t> address = symbol.getAddress();
+                if(!address)
+                {
+                    llvm::consumeError(address.takeError());
+                    continue;
+                }
+
+                m_perfMap
+                    << std::hex << *address << " " << size << std::dec
+                    << " " << name->str() << "\n";
+            }
+
+            m_perfMap.flush();
+        }
+
+        std::mutex m_mutex;
+        std::ofstream m_perfMap;
+    };
+
+    llvm::JITEventListener& jit_listener()
+    {
+        static JitListener instance;
+        return instance;
+    }
+}
+
 std::unique_ptr<llvm::orc::LLJIT> drti::TreenodeCompiler::createJit()
 {
+    PhaseTimer timer(
+        compile_phase::jit_create,
+        m_node,
+        m_caller.m_landing_site.function_name);
+
     llvm::orc::JITTargetMachineBuilder jtmb(
         llvm::cantFail(llvm::orc::JITTargetMachineBuilder::detectHost()));
     // I think this controls machine code optimizations only (not the
@@ -548,40 +1535,265 @@ std::unique_ptr<llvm::orc::LLJIT> drti::TreenodeCompiler::createJit()
     llvm::orc::LLJITBuilder bs;
     bs.setJITTargetMachineBuilder(jtmb);
 
+    // The same object layer that LLJIT would create by default, with
+    // our listener to see the machine code and optionally those that
+    // tell profilers and debuggers about it
+    bs.setObjectLinkingLayerCreator(
+        [](llvm::orc::ExecutionSession& session, const llvm::Triple&) {
+            auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                session,
+                []() { return std::make_unique<llvm::SectionMemoryManager>(); });
+            layer->registerJITEventListener(jit_listener());
+            if(config.gdb_jit)
+            {
+                layer->registerJITEventListener(
+                    *llvm::JITEventListener::createGDBRegistrationListener());
+            }
+            if(config.perf_map > 1)
+            {
+                // Null if LLVM was built without perf support
+                if(llvm::JITEventListener* perf =
+                   llvm::JITEventListener::createPerfJITEventListener())
+                {
+                    layer->registerJITEventListener(*perf);
+                }
+            }
+            return llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>(
+                std::move(layer));
+        });
+
     auto maybeJit(bs.create());
 
-    CHECK_WRAPPER(m_node->location.landing, "LLJIT::Create", maybeJit);
+    CHECK_WRAPPER(
+        jit_error, m_node->location.landing, "LLJIT::Create", maybeJit);
 
     return std::move(*maybeJit);
 }
 
-void drti::TreenodeCompiler::linkModules()
+drti::InlineEdge drti::TreenodeCompiler::createEdge(
+    treenode* node, landing_site& landing, int depth)
+{
+    m_bytes_parsed += landing.self->module_size;
+    m_included.push_back(&landing);
+
+    InlineEdge edge{
+        node,
+        std::make_unique<ReflectedModule>(m_context, landing),
+        {}};
+
+    // If the leaf has itself made calls that landed in decorated
+    // functions we can inline those as well
+    edge.onward = selectEdges(node, landing, depth + 1);
+
+    return edge;
+}
+
+//! The function is where context's calls landed, passed separately
+//! since application threads can clear and set context->landing
+std::vector<drti::InlineEdge> drti::TreenodeCompiler::selectEdges(
+    treenode* context, const landing_site& function, int depth)
+{
+    // The function being recompiled here is the one that context
+    // landed in, and the calls it made in that context are the
+    // children of context. From each of its callsites we pick the
+    // hottest few targets, which become the arms of a guarded
+    // dispatch, unless the site has seen so many targets that it
+    // is megamorphic. Limits on targets and callsites keep a bound
+    // on the combinations we compile
+    std::vector<InlineEdge> result;
+
+    if(depth > config.max_inline_depth)
+    {
+        return result;
+    }
+
+    int callsites_used = 0;
+
+    for(size_t index = 0;
+        index < function.callsites_size
+            && callsites_used < config.max_inline_callsites;
+        ++index)
+    {
+        const static_callsite* callsite = function.callsites[index];
+
+        // Snapshot the counts since they can change while we sort,
+        // and the landings which can be cleared
+        std::vector<std::tuple<int64_t, treenode*, landing_site*>> candidates;
+        int targets_seen = 0;
+        int64_t site_calls = 0;
+
+        for(treenode* child = atomic_load(&context->children);
+            child;
+            child = child->next_sibling)
+        {
+            if(&child->location == callsite)
+            {
+                int64_t calls = child->chain_calls;
+                ++targets_seen;
+                site_calls += calls;
+                if(landing_site* landing = landing_of(child))
+                {
+                    candidates.emplace_back(calls, child, landing);
+                }
+                // otherwise not (yet) known to arrive in a decorated
+                // function
+            }
+        }
+
+        if(targets_seen > config.megamorphic_targets)
+        {
+            if(config.log_level >= log_level::trace)
+            {
+                LogMessage()
+                    << function.function_name
+                    << " call_number "
+                    << callsite->call_number
+                    << " is megamorphic with "
+                    << targets_seen
+                    << " targets";
+            }
+            continue;
+        }
+
+        std::stable_sort(
+            candidates.begin(), candidates.end(),
+            [](const auto& lhs, const auto& rhs) {
+                return std::get<0>(lhs) > std::get<0>(rhs);
+            });
+
+        int arms = 0;
+        for(const auto& [count, child, landing]: candidates)
+        {
+            if(arms >= config.max_polymorphic_targets)
+            {
+                break;
+            }
+            else if(std::find(m_included.begin(), m_included.end(), landing)
+                    != m_included.end())
+            {
+                // Recursive, or already linked for another edge
+            }
+            else if(known_failure(function, *landing))
+            {
+                if(config.log_level >= log_level::trace)
+                {
+                    LogMessage()
+                        << "not inlining "
+                        << landing->function_name
+                        << " (failed before)";
+                }
+            }
+            else if(m_bytes_parsed + landing->self->module_size
+                    > config.max_inline_bytes)
+            {
+                if(config.log_level >= log_level::trace)
+                {
+                    LogMessage()
+                        << "not inlining "
+                        << landing->function_name
+                        << " (exceeds max_inline_bytes)";
+                }
+            }
+            else
+            {
+                result.push_back(createEdge(child, *landing, depth));
+                result.back().calls = count;
+                result.back().site_calls = site_calls;
+                ++arms;
+            }
+        }
+
+        if(arms)
+        {
+            ++callsites_used;
+        }
+    }
+
+    return result;
+}
+
+void drti::TreenodeCompiler::collectModules(
+    const InlineEdge& edge, std::vector<const ReflectedModule*>& modules) const
+{
+    modules.push_back(edge.leaf.get());
+    for(const InlineEdge& onward: edge.onward)
+    {
+        collectModules(onward, modules);
+    }
+}
+
+//! Give the optimizer the observed entry count, since the bitcode
+//! has no profile data of its own
+static void setEntryCount(llvm::Function& function, const drti::landing_site& site)
+{
+    function.setEntryCount(
+        llvm::Function::ProfileCount(
+            site.total_called, llvm::Function::PCT_Real));
+}
+
+void drti::TreenodeCompiler::prepareLeaves(InlineEdge& edge)
+{
+    llvm::Function* leaf_func = edge.leaf->callsite_function();
+
+    // Make leaf function externally visible so it can be linked for
+    // inlining.
+    leaf_func->setLinkage(llvm::GlobalValue::LinkOnceAnyLinkage);
+    // Why is this necessary, and why isn't the loop in
+    // fpointer_main.cpp do_call being optimized away after increment1
+    // is inlined?
+    leaf_func->addFnAttr(llvm::Attribute::AlwaysInline);
+    setEntryCount(*leaf_func, edge.leaf->m_landing_site);
+
+    for(InlineEdge& onward: edge.onward)
+    {
+        prepareLeaves(onward);
+    }
+}
+
+void drti::TreenodeCompiler::linkModules(InlineEdge& edge)
 {
+    ReflectedModule& leaf(*edge.leaf);
+
     if(config.log_level >= log_level::debug)
     {
-        llvm::raw_os_ostream stream(std::cerr);
-        std::unique_ptr<llvm::ModulePass> printer(
-            llvm::createPrintModulePass(
-                stream, "------- drti linking -------"));
-        printer->runOnModule(*m_caller.m_module);
-        printer->runOnModule(*m_leaf.m_module);
+        log_ir([&](llvm::raw_ostream& stream) {
+            std::unique_ptr<llvm::ModulePass> printer(
+                llvm::createPrintModulePass(
+                    stream, "------- drti linking -------"));
+            printer->runOnModule(*m_caller.m_module);
+            printer->runOnModule(*leaf.m_module);
+        });
     }
 
+    // The destination only reaches the leaf via a function pointer,
+    // so declare it to make sure LinkOnlyNeeded brings it across
+    llvm::Function* leaf_func = leaf.callsite_function();
+    m_caller.m_module->getOrInsertFunction(
+        leaf_func->getName(), leaf_func->getFunctionType());
+
     llvm::Linker linker(*m_caller.m_module);
     if(linker.linkInModule(
-           std::move(m_leaf.m_ownModule), llvm::Linker::LinkOnlyNeeded))
+           std::move(leaf.m_ownModule), llvm::Linker::LinkOnlyNeeded))
     {
         maybe_log_error(
-            m_leaf.m_landing_site,
-            "TreenodeCompiler::createJit",
+            leaf.m_landing_site,
+            "TreenodeCompiler::linkModules",
             "Linking failed");
 
-        throw InternalCompilerError();
+        throw InternalCompilerError{
+            failure_reason::link_failure,
+            &edge.node->location.landing,
+            &leaf.m_landing_site};
     }
 
-    // m_leaf.m_ownModule is empty now, and we redirect its non-owned
+    // leaf.m_ownModule is empty now, and we redirect its non-owned
     // pointer here
-    m_leaf.m_module = m_caller.m_module;
+    leaf.m_module = m_caller.m_module;
+
+    for(InlineEdge& onward: edge.onward)
+    {
+        linkModules(onward);
+    }
 }
 
 static std::string describeType(llvm::Type* type)
@@ -605,22 +1817,29 @@ static std::string describeType(llvm::Type* type)
     }
 }
 
-llvm::Function* drti::TreenodeCompiler::findConverter(
-    llvm::Type* fromType, llvm::Type* toType) const
+//! Collects the converters from the caller's module, which must
+//! already have all the leaves linked in
+void drti::TreenodeCompiler::indexConverters()
 {
-    for(llvm::Function& function: *m_leaf.m_module)
+    for(llvm::Function& function: *m_caller.m_module)
     {
         // Workaround C++ name mangling on the __drti_converter
-        if((function.getName().str().find("__drti_converter") != std::string::npos)
+        if(function.getName().contains("__drti_converter")
            && (function.arg_size() == 2)
-           && (function.arg_begin()->getType() == fromType)
-           && ((function.arg_begin() + 1)->getType() == toType)
-           && (function.getReturnType() == toType))
+           && ((function.arg_begin() + 1)->getType() == function.getReturnType()))
         {
-            return &function;
+            m_converters.try_emplace(
+                {function.arg_begin()->getType(), function.getReturnType()},
+                &function);
         }
     }
-    return nullptr;
+}
+
+llvm::Function* drti::TreenodeCompiler::findConverter(
+    llvm::Type* fromType, llvm::Type* toType) const
+{
+    auto found = m_converters.find({fromType, toType});
+    return found == m_converters.end() ? nullptr : found->second;
 }
 
 llvm::Value* drti::TreenodeCompiler::maybeCoerce(
@@ -664,14 +1883,16 @@ llvm::Value* drti::TreenodeCompiler::maybeCoerce(
 llvm::Value* drti::TreenodeCompiler::argTypeMismatch(
     const llvm::Use& argUse,
     const llvm::Argument& parameter,
-    const llvm::Function& function) const
+    const InlineEdge& arm) const
 {
+    const llvm::Function& function(*arm.leaf->callsite_function());
     llvm::Type* useType = argUse.get()->getType();
     llvm::Type* paramType = parameter.getType();
     if(config.log_level >= log_level::error)
     {
-        log_stream
-            << "DRTI type mismatch for call resolved to "
+        LogMessage message;
+        message
+            << "type mismatch for call resolved to "
             << function.getName().str()
             << " at argument "
             // These number from zero as you undoutably know
@@ -682,97 +1903,133 @@ llvm::Value* drti::TreenodeCompiler::argTypeMismatch(
 
         if(!useTypeName.empty() && ! paramTypeName.empty())
         {
-            log_stream
+            message
                 << " (" << useTypeName
                 << " but expecting " << paramTypeName
                 << ")";
         }
-
-        log_stream
-            << "\n";
     }
-    throw InternalCompilerError();
+    throw InternalCompilerError{
+        failure_reason::arg_type_mismatch,
+        &arm.node->location.landing,
+        &arm.leaf->m_landing_site};
 }
 
-void drti::TreenodeCompiler::reprocess(
-    llvm::CallBase* callInst, ReflectedModule& leaf)
+//! Finds the this-adjusting thunk that the arm's call target points
+//! to, in either its landing or calling module. Thunks are emitted
+//! with the vtable, which is normally in the same module as the
+//! overriding function
+const drti::thunk_info* drti::TreenodeCompiler::findThunk(
+    const InlineEdge& arm) const
 {
-    // Split the existing block
-    // BB1:
-    //   xxx
-    //   original = call value(...)
-    //   yyy
-    //
-    // like this:
-    // BB1:
-    //   xxx
-    //   matches = value == known
-    //   br i1 matches, BB2, BB3
-    // BB2:
-    //   res1 = call inlinable_function(...)
-    //   br BB4
-    // BB3:
-    //   original = call value(...)
-    //   br BB4
-    // BB4:
-    //   res = phi [ res1, BB2 ], [ original, BB3 ]
-    //   yyy
-        
-
-    llvm::IRBuilder<> builder(callInst);
+    for(const reflect* self: {&arm.leaf->m_self, &m_caller.m_self})
+    {
+        const thunk_info* end = self->thunks + self->thunks_size;
+        const thunk_info* found = std::find_if(
+            self->thunks, end,
+            [&arm](const thunk_info& thunk) {
+                return thunk.address == arm.node->target;
+            });
+        if(found != end)
+        {
+            return found;
+        }
+    }
+    return nullptr;
+}
 
-    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+//! Converts the receiver of a virtual call to the this pointer that
+//! the arm's leaf function expects, as an i8*. Returns nullptr if the
+//! call target is neither the leaf function nor a thunk we know about
+llvm::Value* drti::TreenodeCompiler::adjustReceiver(
+    llvm::IRBuilder<>& builder,
+    llvm::CallBase* callInst,
+    const InlineEdge& arm) const
+{
+    llvm::Value* receiver = builder.CreateBitCast(
+        callInst->getArgOperand(0), builder.getInt8PtrTy(), "drti_receiver");
 
-    llvm::Value* target = builder.CreatePointerCast(
-        callInst->getCalledOperand(), int64, "castTarget");
+    if(arm.node->target == arm.leaf->m_landing_site.function)
+    {
+        // The vtable slot was for this class, so the pointer is
+        // already right and only its static type differs
+        return receiver;
+    }
 
-    llvm::Constant* knownTarget =
-        llvm::ConstantInt::get(
-            int64, reinterpret_cast<uintptr_t>(m_node->target));
+    const thunk_info* thunk = findThunk(arm);
+    if(!thunk)
+    {
+        return nullptr;
+    }
 
-    llvm::Value* matches = builder.CreateICmpEQ(
-        target, knownTarget, "matches");
+    // Do what the thunk does, as in the Itanium C++ ABI: the fixed
+    // adjustment first, then any offset from the adjusted vtable
+    if(thunk->fixed_offset)
+    {
+        receiver = builder.CreateConstInBoundsGEP1_64(
+            builder.getInt8Ty(), receiver, thunk->fixed_offset,
+            "drti_adjusted");
+    }
 
-    llvm::BasicBlock* bb1 = callInst->getParent();
-    llvm::BasicBlock* bb3 = bb1->splitBasicBlock(callInst, "drti_bb3");
-    llvm::BasicBlock* bb4 = bb3->splitBasicBlock(
-        callInst->getNextNode(), "drti_bb4");
-    llvm::BasicBlock* bb2 = llvm::BasicBlock::Create(
-        m_context, "drti_bb2", bb1->getParent(), bb3);
-    // TODO - instrument (redecorate) the slow path in bb3
+    if(thunk->vcall_offset)
+    {
+        llvm::Type* int64 = builder.getInt64Ty();
+        llvm::Value* vtable = builder.CreateLoad(
+            builder.getInt8PtrTy(),
+            builder.CreateBitCast(
+                receiver, builder.getInt8PtrTy()->getPointerTo()),
+            "drti_vtable");
+        llvm::Value* slot = builder.CreateConstInBoundsGEP1_64(
+            builder.getInt8Ty(), vtable, thunk->vcall_offset);
+        llvm::Value* offset = builder.CreateLoad(
+            int64,
+            builder.CreateBitCast(slot, int64->getPointerTo()),
+            "drti_vcall_offset");
+        receiver = builder.CreateInBoundsGEP(
+            builder.getInt8Ty(), receiver, offset, "drti_adjusted");
+    }
 
-    // Remove the unconditional branch inserted by splitBasicBlock
-    builder.SetInsertPoint(bb1, bb1->back().eraseFromParent());
-    // TODO - add branch weights
-    builder.CreateCondBr(matches, bb2, bb3);
+    return receiver;
+}
 
-    // The inlinable function call
-    builder.SetInsertPoint(bb2);
+llvm::CallBase* drti::TreenodeCompiler::createDirectCall(
+    llvm::IRBuilder<>& builder, llvm::CallBase* callInst, const InlineEdge& arm)
+{
+    ReflectedModule& leaf(*arm.leaf);
 
     if(callInst->arg_size() != leaf.callsite_function()->arg_size())
     {
         if(config.log_level >= log_level::error)
         {
-            log_stream
-                << "DRTI call with "
+            LogMessage()
+                << "call with "
                 << callInst->arg_size()
                 << " arguments resolved to "
                 << leaf.callsite_function()->getName().str()
                 << " which expects "
-                << leaf.callsite_function()->arg_size()
-                << "\n";
+                << leaf.callsite_function()->arg_size();
         }
-        throw InternalCompilerError();
+        throw InternalCompilerError{
+            failure_reason::arg_count_mismatch,
+            &arm.node->location.landing,
+            &leaf.m_landing_site};
     }
 
     llvm::SmallVector<llvm::Value*, 20> args;
     llvm::iterator_range<llvm::Function::arg_iterator> targetArgs(
         leaf.callsite_function()->args());
     int alreadyCoerced = 0;
+    // For virtual calls the receiver may need more than a change of
+    // type, if the target was a thunk
+    llvm::Value* receiver = virtual_call_vtable(*callInst)
+        ? adjustReceiver(builder, callInst, arm)
+        : nullptr;
+    llvm::Function::arg_iterator targetArg = targetArgs.begin();
     for(llvm::Use& argUse: callInst->arg_operands())
     {
-        llvm::Value* arg =
-            maybeCoerce(builder, argUse, *targetArgs.begin(), alreadyCoerced);
+        llvm::Value* arg = (receiver && targetArg == targetArgs.begin())
+            ? builder.CreateBitCast(receiver, targetArg->getType())
+            : maybeCoerce(builder, argUse, *targetArg, alreadyCoerced);
 
         if(arg)
         {
@@ -780,14 +2037,13 @@ void drti::TreenodeCompiler::reprocess(
         }
         else
         {
-            argTypeMismatch(
-                argUse, *targetArgs.begin(), *leaf.callsite_function());
+            argTypeMismatch(argUse, *targetArg, arm);
         }
+        ++targetArg;
     }
 
     llvm::CallBase* directCall = builder.CreateCall(
         leaf.callsite_function(), args);
-    builder.CreateBr(bb4);
 
     llvm::Type* resultType = callInst->getFunctionType()->getReturnType();
     if(resultType != directCall->getFunctionType()->getReturnType())
@@ -796,210 +2052,2024 @@ void drti::TreenodeCompiler::reprocess(
             leaf.m_landing_site,
             "TreenodeCompiler::reprocess",
             "Result type mismatch");
-        throw InternalCompilerError();
+        throw InternalCompilerError{
+            failure_reason::result_type_mismatch,
+            &arm.node->location.landing,
+            &leaf.m_landing_site};
     }
 
-    if(!resultType->isVoidTy())
-    {
-        // Create a PHI node for the results from the two branches
-        builder.SetInsertPoint(bb4, bb4->begin());
-        llvm::PHINode* resultPhi = builder.CreatePHI(
-            resultType, 2, "drti_merged_result");
-        // Replace any uses of the original return value with the PHI node
-        callInst->replaceAllUsesWith(resultPhi);
-        resultPhi->addIncoming(directCall, bb2);
-        resultPhi->addIncoming(callInst, bb3);
-    }
+    return directCall;
+}
 
-    // Clean up the builder in case of any further insertions by our
-    // caller
-    builder.SetInsertPoint(bb4);
+//! Roughly whether the address is on the current thread's stack, in
+//! one of the frames above ours. Such arguments are usually
+//! references to the caller's locals, which only stay the same while
+//! it keeps calling from the same frame
+static bool onStack(const void* address)
+{
+    const char here = 0;
+    uintptr_t above =
+        reinterpret_cast<uintptr_t>(address)
+        - reinterpret_cast<uintptr_t>(&here);
+    return above < (8 << 20);
 }
 
-//! For calls via a function pointer we add code to check the pointer
-//! value before using the direct call determined at runtime (fast
-//! path), and call via the pointer otherwise (slow path). Currently
-//! only handles a single call site
-void drti::TreenodeCompiler::reprocess(
-    llvm::Function* function, ReflectedModule& leaf, const static_callsite& callsite)
+//! Finds pointer arguments to the leaf that had the same value in at
+//! least config.stable_arg_percent of the landings via the arm's
+//! node. Returns (argument number, value) pairs
+std::vector<std::pair<unsigned, const void*>>
+drti::TreenodeCompiler::stableArguments(
+    const InlineEdge& arm, const llvm::CallBase* callInst)
 {
-    // TODO - handle multiple callsites. Probably our landing_site
-    // needs references to all its contained callsites so we can
-    // reprocess all of them at once. Combinations could explode
-    // with all the possible treenodes from each callsite
-    unsigned call_number = 0;
-    for(llvm::BasicBlock& block: *function)
+    std::vector<std::pair<unsigned, const void*>> result;
+
+    const int64_t calls = arm.node->chain_calls;
+    if(calls < config.min_arg_samples)
     {
-        for(llvm::Instruction& instruction: block)
+        return result;
+    }
+
+    // Must match the numbering in drti-decorate's add_landing_update
+    unsigned slot = 0;
+    for(llvm::Argument& argument: arm.leaf->callsite_function()->args())
+    {
+        if(slot >= profiled_args)
         {
-            auto callInst = llvm::dyn_cast<llvm::CallBase>(&instruction);
-            if(callInst)
+            break;
+        }
+        if(!is_profiled_argument(argument))
+        {
+            continue;
+        }
+
+        const arg_profile& profile(arm.node->args[slot++]);
+        const void* value =
+            atomic_load_explicit(&profile.value, memory_order_relaxed);
+        const int64_t same = profile.same;
+        const unsigned argNo = argument.getArgNo();
+
+        if(value
+           && !onStack(value)
+           && same * 100 >= calls * config.stable_arg_percent
+           && argNo < callInst->arg_size()
+           && callInst->getArgOperand(argNo)->getType()->isPointerTy())
+        {
+            if(config.log_level >= log_level::trace)
             {
-                llvm::Function* calledFunction(callInst->getCalledFunction());
-                if(config.log_level >= log_level::trace)
-                {
-                    log_stream
-                        << "DRTI "
-                        << function->getName().str()
-                        << " call_number "
-                        << call_number
-                        << " "
-                        << (calledFunction ?
-                            calledFunction->getName().str() :
-                            std::string("pointer"))
-                        << "\n";
-                }
+                LogMessage()
+                    << "specialising "
+                    << arm.leaf->m_landing_site.function_name
+                    << " argument "
+                    << argNo
+                    << " as "
+                    << value
+                    << " ("
+                    << same
+                    << " of "
+                    << calls
+                    << " calls)";
+            }
+            result.emplace_back(argNo, value);
+        }
+    }
 
-                if(call_number == callsite.call_number)
-                {
-                    // Currently we only need to reprocess calls via
-                    // function pointers, so not those direct to a
+    return result;
+}
+
+//! A constant for a specialised argument value. If it's a function
+//! that we have in the bitcode then we use that, so the optimizer can
+//! inline calls through the argument
+llvm::Constant* drti::TreenodeCompiler::argumentConstant(
+    const void* value, llvm::Type* type) const
+{
+    Dl_info info;
+    if(dladdr(value, &info) && info.dli_saddr == value && info.dli_sname)
+    {
+        llvm::Function* function =
+            m_caller.m_module->getFunction(info.dli_sname);
+        if(function)
+        {
+            return llvm::ConstantExpr::getBitCast(function, type);
+        }
+    }
+
+    return llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(
+            llvm::IntegerType::get(m_context, 64),
+            reinterpret_cast<uintptr_t>(value)),
+        type);
+}
+
+static llvm::MDNode* branchWeights(
+    llvm::LLVMContext& context, int64_t taken, int64_t notTaken)
+{
+    // Weights are only 32 bits so scale large counts down together
+    uint64_t high = std::max<int64_t>({taken, notTaken, 0});
+    uint64_t scale = high / std::numeric_limits<uint32_t>::max() + 1;
+
+    return llvm::MDBuilder(context).createBranchWeights(
+        std::max<int64_t>(taken, 0) / scale,
+        std::max<int64_t>(notTaken, 0) / scale);
+}
+
+//! Adds an atomic increment of a counter that lives in the runtime
+llvm::Value* drti::TreenodeCompiler::atomicIncrement(
+    llvm::IRBuilder<>& builder, counter_t& counter)
+{
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+
+    llvm::Value* address = builder.CreateIntToPtr(
+        llvm::ConstantInt::get(int64, reinterpret_cast<uintptr_t>(&counter)),
+        int64->getPointerTo());
+
+    return builder.CreateAtomicRMW(
+        llvm::AtomicRMWInst::Add,
+        address,
+        llvm::ConstantInt::get(int64, 1),
+        llvm::MaybeAlign(alignof(counter_t)),
+        llvm::AtomicOrdering::Monotonic);
+}
+
+//! Adds an atomic increment of the guard hit counter for the calling
+//! thread, picked by hashing the stack pointer. Threads have separate
+//! stacks, so they mostly use different counters. x86-64 only, like
+//! the rest of the runtime
+void drti::TreenodeCompiler::countHit(
+    llvm::IRBuilder<>& builder, GuardCounters& guard)
+{
+    // stack = read_register("rsp")
+    // shard = ((stack >> 12) * golden) >> (64 - guard_hit_shard_bits)
+    // atomicrmw add hits[shard].count, 1
+
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+
+    llvm::Function* readRegister = llvm::Intrinsic::getDeclaration(
+        builder.GetInsertBlock()->getModule(),
+        llvm::Intrinsic::read_register,
+        {int64});
+    llvm::MDNode* rsp = llvm::MDNode::get(
+        m_context, {llvm::MDString::get(m_context, "rsp")});
+    llvm::Value* stack = builder.CreateCall(
+        readRegister, {llvm::MetadataAsValue::get(m_context, rsp)}, "stack");
+
+    // Fibonacci hashing, since thread stacks tend to be a power of
+    // two apart
+    llvm::Value* shard = builder.CreateLShr(
+        builder.CreateMul(
+            builder.CreateLShr(stack, 12),
+            llvm::ConstantInt::get(int64, 0x9e3779b97f4a7c15ull)),
+        64 - guard_hit_shard_bits,
+        "shard");
+
+    llvm::Value* address = builder.CreateIntToPtr(
+        builder.CreateAdd(
+            llvm::ConstantInt::get(
+                int64, reinterpret_cast<uintptr_t>(&guard.hits[0].count)),
+            builder.CreateMul(
+                shard, llvm::ConstantInt::get(int64, sizeof(GuardHitShard)))),
+        int64->getPointerTo());
+
+    builder.CreateAtomicRMW(
+        llvm::AtomicRMWInst::Add,
+        address,
+        llvm::ConstantInt::get(int64, 1),
+        llvm::MaybeAlign(alignof(counter_t)),
+        llvm::AtomicOrdering::Monotonic);
+}
+
+//! Called from JIT-compiled code every housekeeping_interval guard
+//! misses
+static void guard_missed(uintptr_t guard)
+{
+    drti::check_guard(*reinterpret_cast<drti::GuardCounters*>(guard));
+}
+
+llvm::BasicBlock* drti::TreenodeCompiler::createMissBlock(
+    GuardCounters& guard, llvm::BasicBlock* slowPath)
+{
+    // drti_miss:
+    //   count = atomicrmw add misses, 1
+    //   due = (count + 1) % housekeeping_interval == 0
+    //   br i1 due, drti_deopt_check, BB3
+    // drti_deopt_check:
+    //   call guard_missed(guard)
+    //   br BB3
+
+    llvm::Function* function = slowPath->getParent();
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+
+    llvm::BasicBlock* missBlock = llvm::BasicBlock::Create(
+        m_context, "drti_miss", function, slowPath);
+    llvm::BasicBlock* checkBlock = llvm::BasicBlock::Create(
+        m_context, "drti_deopt_check", function, slowPath);
+
+    llvm::IRBuilder<> builder(missBlock);
+
+    llvm::Value* count = builder.CreateAdd(
+        atomicIncrement(builder, guard.misses), llvm::ConstantInt::get(int64, 1));
+    llvm::Value* due = builder.CreateICmpEQ(
+        builder.CreateURem(
+            count, llvm::ConstantInt::get(int64, housekeeping_interval)),
+        llvm::ConstantInt::get(int64, 0),
+        "due");
+    builder.CreateCondBr(
+        due, checkBlock, slowPath,
+        branchWeights(m_context, 1, housekeeping_interval - 1));
+
+    builder.SetInsertPoint(checkBlock);
+    llvm::FunctionType* checkType = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(m_context), {int64}, false);
+    llvm::Value* callee = builder.CreateIntToPtr(
+        llvm::ConstantInt::get(
+            int64, reinterpret_cast<uintptr_t>(&guard_missed)),
+        checkType->getPointerTo());
+    builder.CreateCall(
+        checkType, callee,
+        {llvm::ConstantInt::get(int64, reinterpret_cast<uintptr_t>(&guard))});
+    builder.CreateBr(slowPath);
+
+    return missBlock;
+}
+
+void drti::TreenodeCompiler::reprocess(
+    llvm::CallBase* callInst, const std::vector<InlineEdge*>& arms)
+{
+    // Split the existing block
+    // BB1:
+    //   xxx
+    //   original = call value(...)
+    //   yyy
+    //
+    // like this, with one compare and direct call for each known
+    // target in order of decreasing call frequency:
+    // BB1:
+    //   xxx
+    //   matches = value == known0
+    //   br i1 matches, drti_arm, drti_check
+    // drti_arm:
+    //   res0 = call inlinable_function0(...)
+    //   br BB4
+    // drti_check:
+    //   matches = value == known1
+    //   br i1 matches, drti_arm, drti_miss
+    // drti_arm:
+    //   res1 = call inlinable_function1(...)
+    //   br BB4
+    // drti_miss:
+    //   (see createMissBlock)
+    //   br BB3
+    // BB3:
+    //   original = call value(...)
+    //   br BB4
+    // BB4:
+    //   res = phi [ res0, drti_arm ], [ res1, drti_arm ], [ original, BB3 ]
+    //   yyy
+    //
+    // Each arm also counts a guard hit, so the runtime can tell when
+    // the targets observed before compilation stop being the common
+    // ones. The original call in BB3 gets redecorated by our caller
+
+    llvm::IRBuilder<> builder(callInst);
+
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+
+    llvm::Value* target = builder.CreatePointerCast(
+        callInst->getCalledOperand(), int64, "castTarget");
+
+    // For virtual calls we compare the receiver's vtable pointer where
+    // we know it, rather than the function pointer loaded from the
+    // vtable. The optimizer can then hoist the check and share it
+    // between calls on the same object
+    llvm::LoadInst* vtableLoad = virtual_call_vtable(*callInst);
+    llvm::Value* vtable = vtableLoad
+        ? builder.CreatePtrToInt(vtableLoad, int64, "castVtable")
+        : nullptr;
+
+    llvm::BasicBlock* bb1 = callInst->getParent();
+    llvm::Function* function = bb1->getParent();
+    llvm::BasicBlock* bb3 = bb1->splitBasicBlock(callInst, "drti_bb3");
+    llvm::BasicBlock* bb4 = bb3->splitBasicBlock(
+        callInst->getNextNode(), "drti_bb4");
+
+    // All arms share one set of counters, since a miss means that
+    // none of them matched
+    m_specialisation.guards.emplace_back(
+        new GuardCounters{
+            {}, 0, m_specialisation,
+            arms.front()->node->parent, arms.front()->node->location});
+    GuardCounters& guard(*m_specialisation.guards.back());
+
+    // Remove the unconditional branch inserted by splitBasicBlock
+    builder.SetInsertPoint(bb1, bb1->back().eraseFromParent());
+
+    std::vector<std::pair<llvm::Value*, llvm::BasicBlock*>> results;
+    // Calls observed from this site that didn't go to an earlier arm.
+    // The counts come from this calling context only, which is the
+    // only one that will run the recompiled code
+    int64_t remaining = arms.front()->site_calls;
+
+    for(size_t index = 0; index < arms.size(); ++index)
+    {
+        InlineEdge& arm(*arms[index]);
+
+        llvm::BasicBlock* armBlock = llvm::BasicBlock::Create(
+            m_context, "drti_arm", function, bb3);
+        llvm::BasicBlock* next = (index + 1 < arms.size())
+            ? llvm::BasicBlock::Create(m_context, "drti_check", function, bb3)
+            : createMissBlock(guard, bb3);
+
+        const void* knownVtable = atomic_load_explicit(
+            &arm.node->receiver_vtable, memory_order_relaxed);
+        llvm::Value* matches;
+        if(vtable && knownVtable)
+        {
+            // Other classes sharing the same implementation take the
+            // slow path
+            matches = builder.CreateICmpEQ(
+                vtable,
+                llvm::ConstantInt::get(
+                    int64, reinterpret_cast<uintptr_t>(knownVtable)),
+                "vtableMatches");
+        }
+        else
+        {
+            matches = builder.CreateICmpEQ(
+                target,
+                llvm::ConstantInt::get(
+                    int64, reinterpret_cast<uintptr_t>(arm.node->target)),
+                "matches");
+        }
+
+        // Any pointer arguments that hardly ever change become part
+        // of the guard, so the inlined code can use their values
+        std::vector<std::pair<unsigned, const void*>> stable =
+            stableArguments(arm, callInst);
+        for(const auto& [argNo, value]: stable)
+        {
+            llvm::Value* argMatches = builder.CreateICmpEQ(
+                builder.CreatePtrToInt(callInst->getArgOperand(argNo), int64),
+                llvm::ConstantInt::get(
+                    int64, reinterpret_cast<uintptr_t>(value)),
+                "argMatches");
+            matches = builder.CreateAnd(matches, argMatches);
+        }
+
+        remaining -= arm.calls;
+        builder.CreateCondBr(
+            matches, armBlock, next,
+            branchWeights(m_context, arm.calls, remaining));
+
+        // The inlinable function call
+        builder.SetInsertPoint(armBlock);
+        countHit(builder, guard);
+        llvm::CallBase* directCall = createDirectCall(
+            builder, callInst, arm);
+        if(vtable && knownVtable
+           && arm.node->target == arm.leaf->m_landing_site.function)
+        {
+            // The leaf's this pointer is the receiver, so we know its
+            // dynamic type
+            m_customisable.emplace_back(directCall, knownVtable);
+        }
+        m_specialisation.specialised_args += stable.size();
+        for(const auto& [argNo, value]: stable)
+        {
+            // Unless the argument needed conversion
+            llvm::Value* passed = directCall->getArgOperand(argNo);
+            if(passed->stripPointerCasts()
+               == callInst->getArgOperand(argNo)->stripPointerCasts())
+            {
+                directCall->setArgOperand(
+                    argNo, argumentConstant(value, passed->getType()));
+            }
+        }
+        results.emplace_back(directCall, builder.GetInsertBlock());
+        builder.CreateBr(bb4);
+
+        builder.SetInsertPoint(next, next->begin());
+    }
+
+    llvm::Type* resultType = callInst->getFunctionType()->getReturnType();
+    if(!resultType->isVoidTy())
+    {
+        // Create a PHI node for the results from all the branches
+        builder.SetInsertPoint(bb4, bb4->begin());
+        llvm::PHINode* resultPhi = builder.CreatePHI(
+            resultType, results.size() + 1, "drti_merged_result");
+        // Replace any uses of the original return value with the PHI node
+        callInst->replaceAllUsesWith(resultPhi);
+        for(const auto& [value, block]: results)
+        {
+            resultPhi->addIncoming(value, block);
+        }
+        resultPhi->addIncoming(callInst, bb3);
+    }
+
+    // Clean up the builder in case of any further insertions by our
+    // caller
+    builder.SetInsertPoint(bb4);
+}
+
+static const drti::static_callsite* findCallsite(
+    const drti::landing_site& landing, unsigned call_number)
+{
+    for(size_t index = 0; index < landing.callsites_size; ++index)
+    {
+        if(landing.callsites[index]->call_number == call_number)
+        {
+            return landing.callsites[index];
+        }
+    }
+    return nullptr;
+}
+
+//! For calls via a function pointer we add code to check the pointer
+//! value before using the direct call determined at runtime (fast
+//! path), and call via the pointer otherwise (slow path). Handles
+//! every call site from the function that has an edge, recursing into
+//! each leaf for any onward calls to be inlined along with it. The
+//! function runs only in the given call tree context, so its other
+//! decorated call sites and slow paths get marked for redecoration
+void drti::TreenodeCompiler::reprocess(
+    llvm::Function* function,
+    treenode* context,
+    const landing_site& landing,
+    std::vector<InlineEdge>& edges)
+{
+    // Find all the call instructions first, since reprocessing one
+    // splits its basic block. Edges from the same callsite arrive
+    // together in order of decreasing frequency and become the arms
+    // of a single guard
+    std::vector<std::pair<llvm::CallBase*, std::vector<InlineEdge*>>> found;
+    std::vector<std::pair<llvm::CallBase*, const static_callsite*>> plain;
+
+    unsigned call_number = 0;
+    for(llvm::BasicBlock& block: *function)
+    {
+        for(llvm::Instruction& instruction: block)
+        {
+            auto callInst = llvm::dyn_cast<llvm::CallBase>(&instruction);
+            if(callInst)
+            {
+                llvm::Function* calledFunction(callInst->getCalledFunction());
+                if(config.log_level >= log_level::trace)
+                {
+                    LogMessage()
+                        << function->getName().str()
+                        << " call_number "
+                        << call_number
+                        << " "
+                        << (calledFunction ?
+                            calledFunction->getName().str() :
+                            std::string("pointer"));
+                }
+
+                for(InlineEdge& edge: edges)
+                {
+                    // Currently we only need to reprocess calls via
+                    // function pointers, so not those direct to a
                     // function global. TODO - optimise this ahead of time
-                    if(!calledFunction)
+                    if(call_number == edge.node->location.call_number
+                       && !calledFunction)
                     {
-                        if(config.log_level >= log_level::info)
+                        if(found.empty() || found.back().first != callInst)
                         {
-                            log_stream
-                                << "DRTI "
-                                << function->getName().str()
-                                << " call_number "
-                                << call_number
-                                << " resolved to "
-                                << leaf.m_landing_site.function_name
-                                << "\n";
+                            found.emplace_back(
+                                callInst, std::vector<InlineEdge*>());
                         }
+                        found.back().second.push_back(&edge);
+                    }
+                }
+
+                if(found.empty() || found.back().first != callInst)
+                {
+                    const static_callsite* site =
+                        findCallsite(landing, call_number);
+                    if(site)
+                    {
+                        plain.emplace_back(callInst, site);
+                    }
+                }
+                ++call_number;
+            }
+        }
+    }
+
+    for(auto& [callInst, arms]: found)
+    {
+        if(config.log_level >= log_level::trace)
+        {
+            for(InlineEdge* arm: arms)
+            {
+                LogMessage()
+                    << function->getName().str()
+                    << " call_number "
+                    << arm->node->location.call_number
+                    << " resolved to "
+                    << arm->leaf->m_landing_site.function_name;
+            }
+        }
+
+        if(arms.size() == 1 && soleImplementation(callInst, *arms.front()))
+        {
+            devirtualise(callInst, *arms.front());
+        }
+        else
+        {
+            reprocess(callInst, arms);
+            markForRedecoration(
+                callInst, arms.front()->node->location, context);
+        }
+
+        for(InlineEdge* arm: arms)
+        {
+            reprocess(
+                arm->leaf->callsite_function(),
+                arm->node,
+                arm->leaf->m_landing_site,
+                arm->onward);
+        }
+    }
+
+    for(auto& [callInst, site]: plain)
+    {
+        markForRedecoration(callInst, *site, context);
+    }
+}
+
+//! The C++ class name from an IR pointer type such as
+//! %"class.ns::Name.12"*, or empty if it isn't a pointer to a class
+static std::string className(llvm::Type* type)
+{
+    auto pointer = llvm::dyn_cast<llvm::PointerType>(type);
+    auto structure = pointer
+        ? llvm::dyn_cast<llvm::StructType>(pointer->getElementType())
+        : nullptr;
+    if(!structure || !structure->hasName())
+    {
+        return std::string();
+    }
+
+    llvm::StringRef name = structure->getName();
+    if(!name.consume_front("class.") && !name.consume_front("struct."))
+    {
+        return std::string();
+    }
+
+    // Clang appends a number to distinguish reused names
+    llvm::StringRef unnumbered = name.rtrim("0123456789");
+    if(unnumbered != name && unnumbered.endswith("."))
+    {
+        name = unnumbered.drop_back();
+    }
+    return name.str();
+}
+
+//! Whether a virtual call can only go to the arm's target, because
+//! it is the only implementation of the slot in any loaded class
+bool drti::TreenodeCompiler::soleImplementation(
+    llvm::CallBase* callInst, const InlineEdge& arm)
+{
+    if(!config.whole_program
+       || !llvm::isa<llvm::CallInst>(callInst)
+       || !virtual_call_vtable(*callInst))
+    {
+        return false;
+    }
+
+    // The class that the vtable slot belongs to
+    std::string name = className(
+        callInst->getFunctionType()->getParamType(0));
+    int64_t offset = virtual_call_offset(
+        *callInst, m_caller.m_module->getDataLayout());
+
+    int64_t generation;
+    if(name.empty()
+       || !sole_implementation(name, offset, arm.node->target, generation))
+    {
+        return false;
+    }
+
+    if(m_specialisation.classes_generation < 0)
+    {
+        m_specialisation.classes_generation = generation;
+    }
+    return m_specialisation.classes_generation == generation;
+}
+
+//! Replaces a virtual call with a direct call to its only
+//! implementation. There is no guard, so install() registers the
+//! code for invalidation if another implementation gets loaded
+void drti::TreenodeCompiler::devirtualise(
+    llvm::CallBase* callInst, const InlineEdge& arm)
+{
+    if(config.log_level >= log_level::trace)
+    {
+        LogMessage()
+            << "devirtualising call_number "
+            << arm.node->location.call_number
+            << " to sole implementation "
+            << arm.leaf->m_landing_site.function_name;
+    }
+
+    llvm::IRBuilder<> builder(callInst);
+    llvm::CallBase* directCall = createDirectCall(builder, callInst, arm);
+    callInst->replaceAllUsesWith(directCall);
+    callInst->eraseFromParent();
+    ++m_specialisation.devirtualised_calls;
+}
+
+//! The address point of a vtable in the module we're compiling, as a
+//! constant the optimizer can load from, or nullptr if we don't have
+//! its definition. We find the class from the typeinfo just before
+//! the address point, and the vtable within the class's vtable group
+//! from the offset to top before that
+llvm::Constant* drti::TreenodeCompiler::vtableConstant(
+    const void* vtable) const
+{
+    auto slots = static_cast<const void* const*>(vtable);
+    auto typeinfo = static_cast<const std::type_info*>(slots[-1]);
+    const int64_t offsetToTop = reinterpret_cast<intptr_t>(slots[-2]);
+
+    const char* name = typeinfo->name();
+    // Classes with internal linkage have a marker on their names
+    if(*name == '*')
+    {
+        ++name;
+    }
+
+    llvm::GlobalVariable* group = m_caller.m_module->getGlobalVariable(
+        std::string("_ZTV") + name, true);
+    auto tables = group && group->hasInitializer()
+        ? llvm::dyn_cast<llvm::ConstantStruct>(group->getInitializer())
+        : nullptr;
+    if(!tables)
+    {
+        return nullptr;
+    }
+
+    llvm::Type* int32 = llvm::IntegerType::get(m_context, 32);
+    for(unsigned index = 0; index < tables->getNumOperands(); ++index)
+    {
+        auto table = llvm::dyn_cast<llvm::ConstantArray>(
+            tables->getOperand(index));
+        if(!table)
+        {
+            continue;
+        }
+
+        // Like collect_vtables in drti-decorate.cpp
+        for(unsigned slot = 1; slot < table->getNumOperands(); ++slot)
+        {
+            llvm::Constant* entry = table->getOperand(slot);
+            auto global = llvm::dyn_cast<llvm::GlobalVariable>(
+                entry->stripPointerCasts());
+            if(!global || !global->getName().startswith("_ZTI"))
+            {
+                continue;
+            }
+
+            llvm::Constant* offset = table->getOperand(slot - 1);
+            if(auto cast = llvm::dyn_cast<llvm::ConstantExpr>(offset))
+            {
+                offset = cast->getOperand(0);
+            }
+            auto value = llvm::dyn_cast<llvm::ConstantInt>(offset);
+            if(!value && !offset->isNullValue())
+            {
+                break;
+            }
+            if((value ? value->getSExtValue() : 0) != offsetToTop)
+            {
+                // Some other base class's vtable
+                break;
+            }
+
+            llvm::Constant* indices[] = {
+                llvm::ConstantInt::get(int32, 0),
+                llvm::ConstantInt::get(int32, index),
+                llvm::ConstantInt::get(int32, slot + 1)
+            };
+            return llvm::ConstantExpr::getInBoundsGetElementPtr(
+                tables->getType(), group, indices);
+        }
+    }
+
+    return nullptr;
+}
+
+//! Whether a function might change the vtable pointer in its this
+//! argument, after which it would no longer match the guard
+static bool mayChangeReceiverType(llvm::Function& function)
+{
+    // Constructors and destructors set the vtable pointer for each
+    // base class in turn, possibly in calls that we can't see
+    llvm::ItaniumPartialDemangler demangler;
+    if(!demangler.partialDemangle(function.getName().str().c_str())
+       && demangler.isCtorOrDtor())
+    {
+        return true;
+    }
+
+    for(llvm::Instruction& instruction: llvm::instructions(function))
+    {
+        auto store = llvm::dyn_cast<llvm::StoreInst>(&instruction);
+        if(store
+           && store->getPointerOperand()->stripPointerCasts()
+              == function.getArg(0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! Replaces the leaf of each direct call in m_customisable with a
+//! clone specialised on the receiver's class. Virtual calls on this
+//! inside the clone load from the constant vtable, which the
+//! optimizer can fold to a direct and inlinable call. We do this
+//! after reprocessing so the clone includes any onward guards
+void drti::TreenodeCompiler::customise()
+{
+    // Innermost calls first, so that clones of outer leaves contain
+    // the customised inner calls
+    for(auto it = m_customisable.rbegin(); it != m_customisable.rend(); ++it)
+    {
+        auto& [call, vtable] = *it;
+        llvm::Function* leaf = call->getCalledFunction();
+        if(!leaf || leaf->arg_empty() || mayChangeReceiverType(*leaf))
+        {
+            continue;
+        }
+
+        llvm::Constant* addressPoint = vtableConstant(vtable);
+        if(!addressPoint)
+        {
+            continue;
+        }
+
+        llvm::ValueToValueMapTy map;
+        llvm::Function* clone = llvm::CloneFunction(leaf, map);
+        clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+        clone->setName(leaf->getName() + ".drti_customised");
+
+        int replaced = 0;
+        for(llvm::Instruction& instruction: llvm::instructions(*clone))
+        {
+            auto virtualCall = llvm::dyn_cast<llvm::CallBase>(&instruction);
+            llvm::LoadInst* vtableLoad = virtualCall
+                ? virtual_call_vtable(*virtualCall)
+                : nullptr;
+            if(vtableLoad
+               && vtableLoad->getPointerOperand()->stripPointerCasts()
+                  == clone->getArg(0))
+            {
+                vtableLoad->replaceAllUsesWith(
+                    llvm::ConstantExpr::getBitCast(
+                        addressPoint, vtableLoad->getType()));
+                ++replaced;
+            }
+        }
+
+        if(config.log_level >= log_level::trace)
+        {
+            LogMessage()
+                << "customised "
+                << leaf->getName().str()
+                << " for receiver vtable "
+                << vtable
+                << " ("
+                << replaced
+                << " virtual calls on this)";
+        }
+
+        call->setCalledFunction(clone);
+    }
+}
+
+//! Records the call tree position of a call in the recompiled code
+//! as metadata, to be redecorated after optimization once the
+//! inliner has finished moving calls around
+void drti::TreenodeCompiler::markForRedecoration(
+    llvm::CallBase* callInst,
+    const static_callsite& site,
+    treenode* context)
+{
+    // For a direct call there is only one possible node, which we can
+    // resolve now if it exists
+    treenode* node = nullptr;
+    if(callInst->getCalledFunction())
+    {
+        for(treenode* child = atomic_load(&context->children);
+            child;
+            child = child->next_sibling)
+        {
+            if(&child->location == &site)
+            {
+                node = child;
+                break;
+            }
+        }
+
+        if(!node)
+        {
+            // Never called in this context, and calling the JIT copy
+            // of the function wouldn't land anywhere useful
+            return;
+        }
+    }
+
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+    auto asMetadata = [&](const void* address) {
+        return llvm::ConstantAsMetadata::get(
+            llvm::ConstantInt::get(
+                int64, reinterpret_cast<uintptr_t>(address)));
+    };
+
+    llvm::Metadata* operands[] = {
+        asMetadata(&site), asMetadata(context), asMetadata(node)
+    };
+
+    callInst->setMetadata(
+        "drti.redecorate", llvm::MDNode::get(m_context, operands));
+}
+
+//! Instruments the marked calls so that they continue to build the
+//! call tree like the ahead-of-time decorated code does. Since the
+//! caller and call site are known at this point, calls with a single
+//! possible target use their treenode directly instead of searching
+//! for it via _drti_call_from
+void drti::TreenodeCompiler::redecorate()
+{
+    unsigned kind = m_context.getMDKindID("drti.redecorate");
+
+    std::vector<llvm::CallBase*> marked;
+    for(llvm::Function& function: *m_caller.m_module)
+    {
+        for(llvm::BasicBlock& block: function)
+        {
+            for(llvm::Instruction& instruction: block)
+            {
+                auto callInst = llvm::dyn_cast<llvm::CallBase>(&instruction);
+                if(callInst && callInst->getMetadata(kind))
+                {
+                    marked.push_back(callInst);
+                }
+            }
+        }
+    }
+
+    for(llvm::CallBase* callInst: marked)
+    {
+        redecorate(callInst, *callInst->getMetadata(kind));
+        callInst->setMetadata(kind, nullptr);
+    }
+
+    if(!marked.empty())
+    {
+        // Inline the _drti_call_from helper(s) we just added
+        llvm::legacy::PassManager mpm;
+        mpm.add(llvm::createAlwaysInlinerLegacyPass());
+        mpm.run(*m_caller.m_module);
+    }
+}
+
+void drti::TreenodeCompiler::redecorate(
+    llvm::CallBase* callInst, const llvm::MDNode& marker)
+{
+    auto address = [&](unsigned index) {
+        return llvm::mdconst::extract<llvm::ConstantInt>(
+            marker.getOperand(index))->getZExtValue();
+    };
+
+    auto site = reinterpret_cast<static_callsite*>(address(0));
+    auto node = reinterpret_cast<treenode*>(address(2));
+
+    llvm::IRBuilder<> builder(callInst);
+    llvm::Type* int64 = llvm::IntegerType::get(m_context, 64);
+    llvm::Type* void_ptr_ty = llvm::Type::getInt8PtrTy(m_context);
+
+    llvm::Value* treenode;
+    llvm::Value* resolved_target;
+
+    if(node)
+    {
+        // Same accounting as _drti_call_from without the search
+        atomicIncrement(builder, site->total_calls);
+        atomicIncrement(builder, node->chain_calls);
+
+        treenode = builder.CreateIntToPtr(
+            llvm::ConstantInt::get(int64, address(2)), void_ptr_ty);
+        resolved_target = builder.CreateIntToPtr(
+            llvm::ConstantInt::get(
+                int64, reinterpret_cast<uintptr_t>(&node->resolved_target)),
+            void_ptr_ty->getPointerTo());
+    }
+    else
+    {
+        llvm::LoadInst* vtable = virtual_call_vtable(*callInst);
+        llvm::Function* callFrom = m_caller.m_module->getFunction(
+            vtable ? "_drti_call_from_virtual" : "_drti_call_from");
+        if(!callFrom)
+        {
+            maybe_log_error(
+                m_caller.m_landing_site,
+                "TreenodeCompiler::redecorate",
+                "_drti_call_from not found in module");
+            return;
+        }
+
+        llvm::FunctionType* type = callFrom->getFunctionType();
+        std::vector<llvm::Value*> callFromArgs = {
+            builder.CreateIntToPtr(
+                llvm::ConstantInt::get(int64, address(0)),
+                type->getParamType(0)),
+            builder.CreateIntToPtr(
+                llvm::ConstantInt::get(int64, address(1)),
+                type->getParamType(1)),
+            builder.CreateBitCast(
+                callInst->getCalledOperand(), type->getParamType(2))
+        };
+        if(vtable)
+        {
+            callFromArgs.push_back(
+                builder.CreateBitCast(vtable, type->getParamType(3)));
+        }
+
+        llvm::Value* found = builder.CreateCall(
+            callFrom, callFromArgs, "treenode");
+        // See decorate_call in drti-decorate.cpp
+        resolved_target = builder.CreateStructGEP(
+            llvm::cast<llvm::PointerType>(type->getReturnType())
+                ->getElementType(),
+            found, 5, "resolved_target");
+        treenode = builder.CreateBitCast(found, void_ptr_ty);
+    }
+
+    llvm::Value* newTarget = builder.CreateBitCast(
+        builder.CreateLoad(void_ptr_ty, resolved_target),
+        callInst->getCalledOperand()->getType(),
+        "castResolvedTarget");
+
+    // Must go immediately before the call, for the X86DrtiTreenodePass
+    // that we share with drti-decorate
+    llvm::FunctionCallee drtiSetCaller(
+        m_caller.m_module->getOrInsertFunction(
+            "_drti_set_caller",
+            llvm::Type::getVoidTy(m_context),
+            void_ptr_ty));
+    llvm::Value* setCallerArgs[] = { treenode };
+    builder.CreateCall(drtiSetCaller, setCallerArgs);
+
+    callInst->setCalledOperand(newTarget);
+
+    if(auto* downcast = llvm::dyn_cast<llvm::CallInst>(callInst))
+    {
+        downcast->setTailCallKind(llvm::CallInst::TCK_NoTail);
+    }
+}
+
+void drti::TreenodeCompiler::optimize()
+{
+    PhaseTimer timer(
+        compile_phase::optimize,
+        m_node,
+        m_caller.m_landing_site.function_name);
+
+    llvm::PassManagerBuilder pmb;
+
+    // We like inlining a lot. The normal default cost threshold is
+    // 225
+    pmb.Inliner = llvm::createFunctionInliningPass(1000);
+    pmb.OptLevel = 3;
+
+    llvm::legacy::PassManager mpm;
+
+    pmb.populateModulePassManager(mpm);
+
+    mpm.run(*m_caller.m_module);
+
+    llvm::legacy::FunctionPassManager fpm(m_caller.m_module);
+    pmb.populateFunctionPassManager(fpm);
+
+    // We assume that the leaf function was already optimised during
+    // ahead-of-time compilation, so there is currently not much to be
+    // gained by re-optimizing it now. It might well have been inlined
+    // and deleted by the module passes anyway
+    // fpm.run(*m_edges.front().leaf->callsite_function());
+    fpm.run(*m_caller.callsite_function());
+}
+
+//! Appends a description of what was inlined, e.g.
+//! [leaf1[onward],leaf2] for two arms at one call site
+static void describeEdges(
+    std::string& name, const std::vector<drti::InlineEdge>& edges)
+{
+    name += '[';
+    const char* separator = "";
+    for(const drti::InlineEdge& edge: edges)
+    {
+        name += separator;
+        name += llvm::demangle(edge.leaf->m_landing_site.function_name);
+        if(!edge.onward.empty())
+        {
+            describeEdges(name, edge.onward);
+        }
+        separator = ",";
+    }
+    name += ']';
+}
+
+void* drti::TreenodeCompiler::compile()
+{
+    llvm::orc::LLJIT& jit(*m_jit);
+
+    llvm::Function* caller_func = m_caller.callsite_function();
+
+    if(config.log_level >= log_level::trace)
+    {
+        LogMessage()
+            << "attempting to inline "
+            << m_edges.size()
+            << " call(s) from "
+            << m_caller.m_landing_site.function_name
+            << " ("
+            << m_included.size()
+            << " functions in total)";
+    }
+
+    if(m_edges.empty())
+    {
+        maybe_log_error(
+            m_caller.m_landing_site,
+            "TreenodeCompiler::compile",
+            "No calls selected for inlining");
+        throw InternalCompilerError{
+            failure_reason::nothing_selected, &m_caller.m_landing_site};
+    }
+
+    for(InlineEdge& edge: m_edges)
+    {
+        prepareLeaves(edge);
+    }
+
+    // Make caller extern so we can get its address.  Must do this
+    // before the addIRModule since that scans the module immediately
+    caller_func->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    setEntryCount(*caller_func, m_caller.m_landing_site);
+
+    // This resets the m_ownModule unique_ptr of every leaf and
+    // redirects their m_module
+    {
+        PhaseTimer timer(
+            compile_phase::link,
+            m_node,
+            m_caller.m_landing_site.function_name);
+
+        for(InlineEdge& edge: m_edges)
+        {
+            linkModules(edge);
+        }
+    }
+
+    {
+        PhaseTimer timer(
+            compile_phase::reprocess,
+            m_node,
+            m_caller.m_landing_site.function_name);
+
+        indexConverters();
+        reprocess(
+            caller_func,
+            m_node->parent,
+            m_caller.m_landing_site,
+            m_edges);
+        customise();
+    }
+
+    if(config.log_level >= log_level::trace)
+    {
+        log_ir([&](llvm::raw_ostream& stream) {
+            std::unique_ptr<llvm::ModulePass> printer(
+                llvm::createPrintModulePass(
+                    stream, "------- pre-optimize -------"));
+            printer->runOnModule(*m_caller.m_module);
+        });
+    }
+
+    optimize();
+    redecorate();
+
+    unsigned instructions = caller_func->getInstructionCount();
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        metrics->compiled_instructions += instructions;
+    }
+    if(config.log_level >= log_level::info)
+    {
+        log_event(
+            event_type::compiled_size,
+            m_node,
+            m_caller.m_landing_site.function_name,
+            nullptr,
+            nullptr,
+            instructions);
+    }
+
+    if(config.log_level >= log_level::debug)
+    {
+        log_ir([&](llvm::raw_ostream& stream) {
+            std::unique_ptr<llvm::ModulePass> printer(
+                llvm::createPrintModulePass(
+                    stream, "------- post-optimize -------"));
+            printer->runOnModule(*m_caller.m_module);
+        });
+    }
+
+    // Name the compiled code after what it specialises, e.g.
+    // caller+drti[leaf], which is what perf and gdb will show. Nothing
+    // looks the caller up by its original name from here on
+    std::string compiledName(
+        llvm::demangle(m_caller.m_landing_site.function_name) + "+drti");
+    describeEdges(compiledName, m_edges);
+    caller_func->setName(compiledName);
+    compiledName = caller_func->getName().str();
+
+    llvm::Error bad = jit.addIRModule(
+        llvm::orc::ThreadSafeModule(
+            std::move(m_caller.m_ownModule), m_thread_safe_context));
+
+    CHECK_ERROR(jit_error, m_node->location.landing, "addIRModule", bad);
+
+    if(config.log_level >= log_level::trace)
+    {
+        log_ir([&](llvm::raw_ostream& stream) {
+            std::unique_ptr<llvm::FunctionPass> printer(
+                llvm::createPrintFunctionPass(
+                    stream, "---- drti compiling ----"));
+            printer->runOnFunction(*caller_func);
+        });
+    }
+
+    // TODO - add verifier pass
+    auto maybeAddress = [&]() {
+        // The JIT generates machine code for the module on lookup
+        PhaseTimer timer(
+            compile_phase::codegen,
+            m_node,
+            m_caller.m_landing_site.function_name);
+
+        return jit.lookup(compiledName);
+    }();
+
+    CHECK_WRAPPER(
+        jit_error,
+        m_caller.m_landing_site,
+        "jit.lookup caller",
+        maybeAddress);
+
+    void* result = reinterpret_cast<void*>(maybeAddress->getAddress());
+    if(config.log_level >= log_level::trace)
+    {
+        LogMessage()
+            << m_caller.m_landing_site.function_name
+            << " compiled address "
+            << result;
+    }
+
+    m_specialisation.address = result;
+
+    return result;
+}
+
+//! Redirects the compiled node's parent to the new machine code,
+//! unless it has devirtualised calls and another module has brought
+//! new classes since we looked. Returns true if it installed the code
+bool drti::TreenodeCompiler::install()
+{
+    PhaseTimer timer(
+        compile_phase::install,
+        m_node,
+        m_caller.m_landing_site.function_name);
+
+    LoadedClasses& loaded(loaded_classes());
+    FrozenGlobals& frozen(frozen_globals());
+    std::scoped_lock lock(loaded.mutex, frozen.mutex);
+
+    const char* changed = nullptr;
+    if(m_specialisation.classes_generation >= 0
+       && loaded.generation != m_specialisation.classes_generation)
+    {
+        changed = "the loaded classes";
+    }
+
+    for(const auto& [address, epoch]: m_specialisation.frozen)
+    {
+        auto found = frozen.ranges.find(static_cast<const char*>(address));
+        if(found == frozen.ranges.end() || found->second.epoch != epoch)
+        {
+            changed = "a frozen global";
+        }
+    }
+
+    if(changed)
+    {
+        if(config.log_level >= log_level::trace)
+        {
+            LogMessage()
+                << "discarding "
+                << m_caller.m_landing_site.function_name
+                << " since "
+                << changed
+                << " changed";
+        }
+        m_specialisation.deoptimized = true;
+        return false;
+    }
+
+    if(m_specialisation.classes_generation >= 0)
+    {
+        loaded.dependents.push_back(&m_specialisation);
+    }
+    for(const auto& frozenUse: m_specialisation.frozen)
+    {
+        frozen.ranges[static_cast<const char*>(frozenUse.first)]
+            .dependents.push_back(&m_specialisation);
+    }
+
+    if(shared_metrics())
+    {
+        std::lock_guard<std::mutex> deoptLock(deopt_mutex);
+        for(const auto& guard: m_specialisation.guards)
+        {
+            installed_guards.push_back(guard.get());
+        }
+    }
+
+    atomic_fetch_add(
+        &total_guards_installed,
+        static_cast<int64_t>(m_specialisation.guards.size()));
+    atomic_fetch_add(
+        &total_calls_devirtualised,
+        static_cast<int64_t>(m_specialisation.devirtualised_calls));
+    atomic_fetch_add(
+        &total_arguments_specialised,
+        static_cast<int64_t>(m_specialisation.specialised_args));
+
+    m_specialisation.installed_at->resolved_target = m_specialisation.address;
+    return true;
+}
+
+drti::InstallSiteClaim::InstallSiteClaim(const treenode* installed_at):
+    m_installed_at(installed_at)
+{
+    std::lock_guard<std::mutex> lock(install_sites_mutex);
+    m_claimed = install_sites_busy.insert(installed_at).second;
+}
+
+drti::InstallSiteClaim::~InstallSiteClaim()
+{
+    if(m_claimed)
+    {
+        std::lock_guard<std::mutex> lock(install_sites_mutex);
+        install_sites_busy.erase(m_installed_at);
+    }
+}
+
+//! Compiles a node that inspect_treenode has queued, leaving it
+//! installed, evicted or failed. Throws InternalCompilerError with
+//! the node still compiling
+void drti::compile_treenode(treenode* node)
+{
+    // Once the original caller has been retargeted to a recompiled
+    // version its calls no longer pass through the treenodes below
+    // it, so to inline a deeper chain we recompile the highest
+    // ancestor within config.max_inline_depth, which inlines the
+    // whole chain down to this node. For A* -> B* -> C* -> D* we
+    // recompile A+ with B, C and D inlined and retarget A's caller.
+    treenode* top = node;
+    int depth = 1;
+    while(depth < config.max_inline_depth && top->parent->parent)
+    {
+        top = top->parent;
+        ++depth;
+    }
+
+    if(deopt_limit_reached(top->parent))
+    {
+        transition(
+            node, compile_state::queued, compile_state::failed, "max_deopts");
+        return;
+    }
+    else if(known_failure(top->location.landing))
+    {
+        transition(
+            node, compile_state::queued, compile_state::failed, "known_failure");
+        return;
+    }
+
+    // The state CAS in inspect_treenode only claims the trigger node,
+    // so also claim the node we install at, which other triggers can
+    // share. The loser comes back on its next call, by which time the
+    // winner's code may already cover its chain
+    InstallSiteClaim claim(top->parent);
+    if(!claim)
+    {
+        // Evict before clearing the landing, so that the next call
+        // can queue the node again
+        transition(
+            node, compile_state::queued, compile_state::evicted, "install_busy");
+        clear_landing(node);
+        return;
+    }
+
+    transition(node, compile_state::queued, compile_state::compiling);
+
+    // LEAK the entire thing to prevent cleanup of the generated
+    // machine code. TODO - save just the machine code
+    // Includes parsing the bitcode and creating the JIT, which the
+    // constructor does
+    auto started = std::chrono::steady_clock::now();
+    TreenodeCompiler& treenode_compiler(*new TreenodeCompiler(top, node));
+    treenode_compiler.compile();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count();
+
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        record(metrics->compile_time, elapsed);
+    }
+
+    if(config.log_level >= log_level::info)
+    {
+        const landing_site* landing = landing_of(node);
+        log_event(
+            event_type::compile_finished,
+            node,
+            top->location.landing.function_name,
+            landing ? landing->function_name : nullptr,
+            nullptr,
+            elapsed);
+    }
+
+    if(treenode_compiler.install())
+    {
+        transition(node, compile_state::compiling, compile_state::installed);
+    }
+    else
+    {
+        transition(
+            node, compile_state::compiling, compile_state::evicted, "discarded");
+    }
+}
+
+const char* drti::failure_reason_name(failure_reason reason)
+{
+    switch(reason)
+    {
+        case failure_reason::llvm_error:
+            return "llvm_error";
+        case failure_reason::jit_error:
+            return "jit_error";
+        case failure_reason::missing_function:
+            return "missing_function";
+        case failure_reason::globals_mismatch:
+            return "globals_mismatch";
+        case failure_reason::link_failure:
+            return "link_failure";
+        case failure_reason::arg_count_mismatch:
+            return "arg_count_mismatch";
+        case failure_reason::arg_type_mismatch:
+            return "arg_type_mismatch";
+        case failure_reason::result_type_mismatch:
+            return "result_type_mismatch";
+        case failure_reason::nothing_selected:
+            return "nothing_selected";
+        case failure_reason::count:
+            break;
+    }
+    return "unknown";
+}
+
+int64_t drti::compile_failures(failure_reason reason)
+{
+    return negative_cache.failures[static_cast<int>(reason)];
+}
+
+int64_t drti::compiles_skipped()
+{
+    return negative_cache.skipped;
+}
+
+int64_t drti::guards_installed()
+{
+    return total_guards_installed;
+}
+
+int64_t drti::calls_devirtualised()
+{
+    return total_calls_devirtualised;
+}
+
+int64_t drti::arguments_specialised()
+{
+    return total_arguments_specialised;
+}
+
+//! Adds up the guard counters for the metrics, since the JIT code
+//! updates each guard's own counters directly
+static void sample_guards_forever(drti::metrics_segment* metrics)
+{
+    for(;;)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-                        reprocess(callInst, leaf);
-                    }
-                    return;
-                }
-                ++call_number;
+        int64_t hits = 0;
+        int64_t misses = 0;
+        {
+            std::lock_guard<std::mutex> lock(drti::deopt_mutex);
+            for(const drti::GuardCounters* guard: drti::installed_guards)
+            {
+                hits += guard->total_hits();
+                misses += guard->misses;
             }
         }
+        metrics->guard_hits = hits;
+        metrics->guard_misses = misses;
     }
 }
 
-void drti::TreenodeCompiler::optimize()
+//! The metrics segment, if enabled, with its sampling thread started
+drti::metrics_segment* drti::shared_metrics()
 {
-    llvm::PassManagerBuilder pmb;
+    static metrics_segment* segment = []() {
+        metrics_segment* result = metrics();
+        if(result)
+        {
+            std::thread(sample_guards_forever, result).detach();
+        }
+        return result;
+    }();
+    return segment;
+}
 
-    // We like inlining a lot. The normal default cost threshold is
-    // 225
-    pmb.Inliner = llvm::createFunctionInliningPass(1000);
-    pmb.OptLevel = 3;
+//! Counts the failure and remembers it if trying again would fail
+//! the same way
+void drti::record_failure(const InternalCompilerError& error)
+{
+    atomic_fetch_add(&negative_cache.failures[static_cast<int>(error.reason)], 1);
+
+    // Which calls get selected depends on the counts, which keep
+    // changing, and the JIT works on the caller with whichever leaves
+    // were selected, so neither failure says much about the next try
+    if(error.reason == failure_reason::nothing_selected
+       || error.reason == failure_reason::jit_error
+       || !error.caller)
+    {
+        return;
+    }
 
-    llvm::legacy::PassManager mpm;
+    failure_clock::time_point expiry =
+        config.failure_retry_seconds > 0
+        ? failure_clock::now()
+            + std::chrono::seconds(config.failure_retry_seconds)
+        : failure_clock::time_point::max();
 
-    pmb.populateModulePassManager(mpm);
+    std::lock_guard<std::mutex> lock(negative_cache.mutex);
 
-    mpm.run(*m_caller.m_module);
+    if(error.leaf)
+    {
+        negative_cache.calls[{error.caller, error.leaf, error.reason}] = expiry;
+    }
+    else
+    {
+        negative_cache.landings[error.caller] = expiry;
+    }
+}
 
-    llvm::legacy::FunctionPassManager fpm(m_caller.m_module);
-    pmb.populateFunctionPassManager(fpm);
+//! Returns true if the function's own bitcode failed to compile
+//! recently enough that it would fail again
+bool drti::known_failure(const landing_site& caller)
+{
+    std::lock_guard<std::mutex> lock(negative_cache.mutex);
 
-    // We assume that the leaf function was already optimised during
-    // ahead-of-time compilation, so there is currently not much to be
-    // gained by re-optimizing it now. It might well have been inlined
-    // and deleted by the module passes anyway
-    // fpm.run(*m_leaf.callsite_function());
-    fpm.run(*m_caller.callsite_function());
+    auto found = negative_cache.landings.find(&caller);
+    if(found == negative_cache.landings.end())
+    {
+        return false;
+    }
+    else if(found->second <= failure_clock::now())
+    {
+        negative_cache.landings.erase(found);
+        return false;
+    }
+
+    atomic_fetch_add(&negative_cache.skipped, 1);
+    return true;
 }
 
-void* drti::TreenodeCompiler::compile()
+//! Returns true if inlining leaf into caller would fail, either
+//! because of the leaf's own bitcode or for any reason specific to
+//! the pair
+bool drti::known_failure(const landing_site& caller, const landing_site& leaf)
 {
-    llvm::orc::LLJIT& jit(*m_jit);
+    if(known_failure(leaf))
+    {
+        return true;
+    }
 
-    llvm::Function* caller_func = m_caller.callsite_function();
+    std::lock_guard<std::mutex> lock(negative_cache.mutex);
 
-    if(config.log_level >= log_level::info)
+    auto found = negative_cache.calls.lower_bound(
+        {&caller, &leaf, failure_reason::llvm_error});
+    while(found != negative_cache.calls.end()
+          && std::get<0>(found->first) == &caller
+          && std::get<1>(found->first) == &leaf)
     {
-        log_stream
-            << "DRTI attempting to inline call from "
-            << m_caller.m_landing_site.function_name
-            << " to "
-            << m_leaf.m_landing_site.function_name
-            << std::endl;
+        if(found->second > failure_clock::now())
+        {
+            atomic_fetch_add(&negative_cache.skipped, 1);
+            return true;
+        }
+        found = negative_cache.calls.erase(found);
     }
+    return false;
+}
 
-    // Make leaf function externally visible so it can be linked for
-    // inlining.
-    m_leaf.callsite_function()->setLinkage(llvm::GlobalValue::LinkOnceAnyLinkage);
-    // Why is this necessary, and why isn't the loop in
-    // fpointer_main.cpp do_call being optimized away after increment1
-    // is inlined?
-    m_leaf.callsite_function()->addFnAttr(llvm::Attribute::AlwaysInline);
+bool drti::deopt_limit_reached(const treenode* installed_at)
+{
+    std::lock_guard<std::mutex> lock(deopt_mutex);
 
-    // Make caller extern so we can get its address.  Must do this
-    // before the addIRModule since that scans the module immediately
-    caller_func->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    auto found = deopt_history.find(installed_at);
+    return found != deopt_history.end() && found->second >= config.max_deopts;
+}
 
-    // This resets the m_leaf.m_ownModule unique_ptr and redirects
-    // m_leaf.m_module
-    linkModules();
+int64_t drti::GuardCounters::total_hits() const
+{
+    int64_t total = 0;
+    for(const GuardHitShard& shard: hits)
+    {
+        total += shard.count;
+    }
+    return total;
+}
 
-    reprocess(caller_func, m_leaf, m_node->location);
+void drti::check_guard(GuardCounters& guard)
+{
+    int64_t total_hits = guard.total_hits();
+    int64_t total_misses = guard.misses;
 
-    if(config.log_level >= log_level::trace)
+    std::lock_guard<std::mutex> lock(deopt_mutex);
+
+    // A guard that hit for a long time before its target changed
+    // would otherwise take just as long to notice the change
+    int64_t hits = total_hits - guard.checked_hits;
+    int64_t misses = total_misses - guard.checked_misses;
+    guard.checked_hits = total_hits;
+    guard.checked_misses = total_misses;
+
+    if(guard.owner.deoptimized)
     {
-        llvm::raw_os_ostream stream(std::cerr);
-        std::unique_ptr<llvm::ModulePass> printer(
-            llvm::createPrintModulePass(
-                stream, "------- pre-optimize -------"));
-        printer->runOnModule(*m_caller.m_module);
+        // Another guard in the same code got there first, or a
+        // thread was still running the code after we uninstalled it
+        return;
     }
 
-    optimize();
+    if(guard.owner.installed_at->resolved_target != guard.owner.address)
+    {
+        // Superseded by a later recompilation, e.g. one that added
+        // the targets we were missing
+        guard.owner.deoptimized = true;
+        return;
+    }
 
     if(config.log_level >= log_level::debug)
     {
-        llvm::raw_os_ostream stream(std::cerr);
-        std::unique_ptr<llvm::ModulePass> printer(
-            llvm::createPrintModulePass(
-                stream, "------- post-optimize -------"));
-        printer->runOnModule(*m_caller.m_module);
+        LogMessage()
+            << "guard at "
+            << guard.callsite.landing.function_name
+            << " call_number "
+            << guard.callsite.call_number
+            << " hits "
+            << hits
+            << " misses "
+            << misses;
     }
 
-    llvm::Error bad = jit.addIRModule(
-        llvm::orc::ThreadSafeModule(
-            std::move(m_caller.m_ownModule), m_thread_safe_context));
+    if(misses * 100 >= (hits + misses) * config.deopt_miss_percent)
+    {
+        deoptimize(guard);
+    }
+}
 
-    CHECK_ERROR(m_node->location.landing, "addIRModule", bad);
+//! Puts back the original target at the node where the failing code
+//! was installed and, unless the node has already been deoptimized
+//! config.max_deopts times, arranges for the call site to be
+//! recompiled once it has been profiled again. The machine code is
+//! not freed, since other threads may still be running it.
+//! Requires deopt_mutex
+void drti::deoptimize(GuardCounters& guard)
+{
+    Specialisation& specialisation(guard.owner);
+    treenode* installed_at = specialisation.installed_at;
 
-    if(config.log_level >= log_level::trace)
+    specialisation.deoptimized = true;
+    if(installed_at->resolved_target == specialisation.address)
     {
-        llvm::raw_os_ostream stream(log_stream);
-        std::unique_ptr<llvm::FunctionPass> printer(
-            llvm::createPrintFunctionPass(
-                stream, "---- drti compiling ----"));
-        printer->runOnFunction(*caller_func);
+        installed_at->resolved_target = installed_at->target;
+        evict(specialisation.trigger);
     }
 
-    // TODO - add verifier pass
-    auto maybeAddress = jit.lookup(
-        m_caller.m_landing_site.function_name);
+    int deopts = ++deopt_history[installed_at];
 
-    CHECK_WRAPPER(m_caller.m_landing_site, "jit.lookup caller", maybeAddress);
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        ++metrics->deoptimizations;
+    }
 
-    void* result = reinterpret_cast<void*>(maybeAddress->getAddress());
-    if(config.log_level >= log_level::trace)
+    if(config.log_level >= log_level::info)
     {
-        log_stream
-            << "DRTI "
-            << m_caller.m_landing_site.function_name
-            << " compiled address "
-            << result
-            << std::endl;
+        log_event(
+            event_type::deoptimized,
+            installed_at,
+            installed_at->location.landing.function_name,
+            guard.callsite.landing.function_name,
+            deopts >= config.max_deopts
+                ? "after guard misses (final)"
+                : "after guard misses",
+            deopts);
     }
 
-    return result;
+    if(deopts >= config.max_deopts)
+    {
+        return;
+    }
+
+    // Forget the old counts so the new dominant target wins when we
+    // recompile
+    Reprofile& reprofile(reprofiling[{guard.context, &guard.callsite}]);
+    for(treenode* child = atomic_load(&guard.context->children);
+        child;
+        child = child->next_sibling)
+    {
+        landing_site* landing = landing_of(child);
+        if(&child->location == &guard.callsite && landing)
+        {
+            child->chain_calls = 0;
+            atomic_store_explicit(
+                &child->receiver_vtable, nullptr, memory_order_relaxed);
+            // Otherwise the argument values from before the change
+            // would still look stable against the new call counts
+            for(arg_profile& profile: child->args)
+            {
+                atomic_store_explicit(
+                    &profile.value, nullptr, memory_order_relaxed);
+                profile.same = 0;
+            }
+            reprofile.saved_landings.emplace(child, landing);
+            clear_landing(child);
+            evict(child);
+        }
+    }
 }
 
-void drti::compile_treenode(treenode* node)
+//! Returns true if the node belongs to a call site that was
+//! deoptimized and hasn't yet seen config.reprofile_calls calls with
+//! the original code. Otherwise the caller can go ahead and compile
+bool drti::still_reprofiling(treenode* node)
 {
-    // LEAK the entire thing to prevent cleanup of the generated
-    // machine code. TODO - save just the machine code
-    TreenodeCompiler& treenode_compiler(*new TreenodeCompiler(node));
+    if(!node->parent)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(deopt_mutex);
+
+    auto found = reprofiling.find({node->parent, &node->location});
+    if(found == reprofiling.end())
+    {
+        return false;
+    }
+
+    Reprofile& reprofile(found->second);
+
+    int64_t calls = 0;
+    for(treenode* sibling = atomic_load(&node->parent->children);
+        sibling;
+        sibling = sibling->next_sibling)
+    {
+        if(&sibling->location == &node->location)
+        {
+            calls += sibling->chain_calls;
+        }
+    }
+
+    if(calls < config.reprofile_calls)
+    {
+        // Come back on the next call
+        reprofile.saved_landings.emplace(node, landing_of(node));
+        clear_landing(node);
+        return true;
+    }
+
+    for(auto& [sibling, landing]: reprofile.saved_landings)
+    {
+        atomic_store_explicit(&sibling->landing, landing, memory_order_release);
+    }
+    reprofiling.erase(found);
+
+    return false;
+}
+
+//! Returns true if a node in the chain that compiling this node
+//! would inline has a pointer argument which could still turn out to
+//! be stable, but hasn't yet had config.min_arg_samples calls. The
+//! recompiled code no longer profiles its inlined calls, so we have
+//! to wait for the samples first
+bool drti::awaiting_arg_samples(treenode* node)
+{
+    // At most this many calls can have a different value if the
+    // argument is to pass the stability test with min_arg_samples
+    const int64_t allowed_misses =
+        int64_t(config.min_arg_samples) * (100 - config.stable_arg_percent)
+        / 100;
+
+    // The same chain that compile_treenode recompiles
+    treenode* chain = node;
+    for(int depth = 1; chain->parent; ++depth)
+    {
+        const int64_t calls = chain->chain_calls;
+        if(calls < config.min_arg_samples)
+        {
+            for(const arg_profile& profile: chain->args)
+            {
+                const void* value = atomic_load_explicit(
+                    &profile.value, memory_order_relaxed);
+                if(value
+                   && !onStack(value)
+                   && calls - profile.same <= allowed_misses)
+                {
+                    // Come back on the next call
+                    clear_landing(node);
+                    return true;
+                }
+            }
+        }
+
+        if(depth >= config.max_inline_depth || !chain->parent->parent)
+        {
+            break;
+        }
+        chain = chain->parent;
+    }
+    return false;
+}
+
+drti::LoadedClasses& drti::loaded_classes()
+{
+    // Modules can register during static initialisation
+    static LoadedClasses instance;
+    return instance;
+}
+
+void drti::register_module(reflect* self)
+{
+    LoadedClasses& loaded(loaded_classes());
+    std::lock_guard<std::mutex> lock(loaded.mutex);
+
+    loaded.modules.push_back(self);
+    if(self->vtables_size == 0)
+    {
+        return;
+    }
+
+    for(const vtable_info* vtable = self->vtables;
+        vtable != self->vtables + self->vtables_size;
+        ++vtable)
+    {
+        if(!vtable->address_point)
+        {
+            loaded.incomplete = true;
+        }
+    }
+
+    ++loaded.generation;
+
+    // Any devirtualised call might now have another implementation
+    std::lock_guard<std::mutex> deoptLock(deopt_mutex);
+    for(Specialisation* dependent: loaded.dependents)
+    {
+        invalidate(*dependent, "loading new classes");
+    }
+    loaded.dependents.clear();
+}
+
+//! Puts back the original code for a specialisation that relied on
+//! something which has now changed, and lets the calls through it
+//! land again so that it gets recompiled. The caller must hold
+//! deopt_mutex
+void drti::invalidate(Specialisation& specialisation, const char* why)
+{
+    if(specialisation.deoptimized)
+    {
+        return;
+    }
+
+    specialisation.deoptimized = true;
+    treenode* installed_at = specialisation.installed_at;
+    if(installed_at->resolved_target != specialisation.address)
+    {
+        return;
+    }
+
+    installed_at->resolved_target = installed_at->target;
+    clear_landing(specialisation.compiled);
+    evict(specialisation.compiled);
+    evict(specialisation.trigger);
+
+    if(metrics_segment* metrics = shared_metrics())
+    {
+        ++metrics->deoptimizations;
+    }
+
+    if(config.log_level >= log_level::info)
+    {
+        log_event(
+            event_type::deoptimized,
+            installed_at,
+            installed_at->location.landing.function_name,
+            nullptr,
+            why);
+    }
+}
+
+drti::FrozenGlobals& drti::frozen_globals()
+{
+    // Globals can be frozen during static initialisation
+    static FrozenGlobals instance;
+    return instance;
+}
+
+//! Finds the frozen range that covers size bytes at address
+bool drti::frozen_epoch(const void* address, size_t size, int64_t& epoch)
+{
+    FrozenGlobals& frozen(frozen_globals());
+    std::lock_guard<std::mutex> lock(frozen.mutex);
+
+    auto start = static_cast<const char*>(address);
+    auto found = frozen.ranges.upper_bound(start);
+    if(found == frozen.ranges.begin())
+    {
+        return false;
+    }
+    --found;
+
+    if(start + size > found->first + found->second.size)
+    {
+        return false;
+    }
+
+    epoch = found->second.epoch;
+    return true;
+}
+
+static void thaw_locked(drti::FrozenGlobals& frozen, const void* address)
+{
+    auto found = frozen.ranges.find(static_cast<const char*>(address));
+    if(found == frozen.ranges.end())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> deoptLock(drti::deopt_mutex);
+    for(drti::Specialisation* dependent: found->second.dependents)
+    {
+        drti::invalidate(*dependent, "thawing a frozen global");
+    }
+    frozen.ranges.erase(found);
+}
+
+void drti::freeze_range(const void* address, size_t size)
+{
+    FrozenGlobals& frozen(frozen_globals());
+    std::lock_guard<std::mutex> lock(frozen.mutex);
+
+    thaw_locked(frozen, address);
+    frozen.ranges.emplace(
+        static_cast<const char*>(address),
+        FrozenRange{size, ++frozen.next_epoch, {}});
+}
+
+void drti::thaw_range(const void* address)
+{
+    FrozenGlobals& frozen(frozen_globals());
+    std::lock_guard<std::mutex> lock(frozen.mutex);
+
+    thaw_locked(frozen, address);
+}
+
+//! The ABI class of a typeinfo object, such as
+//! "N10__cxxabiv120__si_class_type_infoE". The runtime is normally
+//! built without RTTI, which rules out dynamic_cast, so this reads
+//! the typeinfo of the typeinfo from its vtable
+static const char* typeinfoKind(const std::type_info& type)
+{
+    auto vtable = *reinterpret_cast<const std::type_info* const* const*>(&type);
+    return vtable[-1]->name();
+}
+
+//! Whether a class or any of its bases has the given name
+static bool derivesFrom(const std::type_info& type, const std::string& name)
+{
+    const char* mangled = type.name();
+    // Classes with internal linkage have a marker on their names
+    if(*mangled == '*')
+    {
+        ++mangled;
+    }
+
+    int status = 0;
+    std::unique_ptr<char, void(*)(void*)> demangled(
+        abi::__cxa_demangle(mangled, nullptr, nullptr, &status), &std::free);
+    if(demangled && name == demangled.get())
+    {
+        return true;
+    }
+
+    const char* kind = typeinfoKind(type);
+    if(!std::strcmp(kind, "N10__cxxabiv120__si_class_type_infoE"))
+    {
+        return derivesFrom(
+            *static_cast<const abi::__si_class_type_info&>(type).__base_type,
+            name);
+    }
+    else if(!std::strcmp(kind, "N10__cxxabiv121__vmi_class_type_infoE"))
+    {
+        auto& multiple(static_cast<const abi::__vmi_class_type_info&>(type));
+        for(unsigned index = 0; index < multiple.__base_count; ++index)
+        {
+            if(derivesFrom(*multiple.__base_info[index].__base_type, name))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//! Whether target is in the slot at the given byte offset in every
+//! loaded vtable for a class derived from the named class, apart
+//! from abstract ones. A class with several dynamic bases has a
+//! vtable for each of them, and we check all of them, which errs on
+//! the side of finding more than one implementation
+bool drti::sole_implementation(
+    const std::string& className,
+    int64_t offset,
+    const void* target,
+    int64_t& generation)
+{
+    LoadedClasses& loaded(loaded_classes());
+    std::lock_guard<std::mutex> lock(loaded.mutex);
+
+    generation = loaded.generation;
+
+    if(loaded.incomplete || offset < 0 || offset % sizeof(void*))
+    {
+        return false;
+    }
+
+    const size_t slot = offset / sizeof(void*);
+    const void* pure_virtual =
+        reinterpret_cast<const void*>(&abi::__cxa_pure_virtual);
+    const void* deleted_virtual =
+        reinterpret_cast<const void*>(&abi::__cxa_deleted_virtual);
+    bool found = false;
+
+    for(const reflect* self: loaded.modules)
+    {
+        for(const vtable_info* vtable = self->vtables;
+            vtable != self->vtables + self->vtables_size;
+            ++vtable)
+        {
+            auto typeinfo = static_cast<const std::type_info*>(
+                vtable->address_point[-1]);
+            if(!derivesFrom(*typeinfo, className))
+            {
+                continue;
+            }
+            if(slot < vtable->slots
+               && (vtable->address_point[slot] == pure_virtual
+                   || vtable->address_point[slot] == deleted_virtual))
+            {
+                continue;
+            }
+            if(slot >= vtable->slots || vtable->address_point[slot] != target)
+            {
+                return false;
+            }
+            found = true;
+        }
+    }
 
-    // Redirect function pointer to the new machine code
-    node->parent->resolved_target = treenode_compiler.compile();
+    return found;
 }
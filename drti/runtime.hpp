@@ -44,6 +44,88 @@ namespace drti
 
     constexpr int abi_version = DRTI_VERSION;
 
+    //! Progress of the runtime recompilation requested by a treenode.
+    //! Each node is compiled at most once at a time: unseen and
+    //! evicted nodes can be queued, and every other transition is
+    //! made by the thread that queued the node
+    enum class compile_state : int
+    {
+        //! Not yet inspected
+        unseen,
+        //! Claimed by a thread that will compile it
+        queued,
+        //! Being compiled
+        compiling,
+        //! Compiled code is installed at the node's ancestor
+        installed,
+        //! Compilation failed or was refused
+        failed,
+        //! The compiled code was discarded or uninstalled, so the
+        //! node can be compiled again
+        evicted
+    };
+
+    using atomic_compile_state = _Atomic(compile_state);
+
+    //! Why the runtime failed to recompile a call chain
+    enum class failure_reason : int
+    {
+        //! LLVM reported an error reading or compiling the bitcode
+        llvm_error,
+        //! The JIT couldn't be created, or failed to add or generate
+        //! code for the recompiled module. These can depend on the
+        //! whole set of inlined leaves, so they aren't remembered
+        jit_error,
+        //! A function was not found in its module's bitcode
+        missing_function,
+        //! A module's bitcode refers to more globals than it recorded
+        globals_mismatch,
+        //! A leaf's module couldn't be linked with its caller
+        link_failure,
+        //! A call's arguments didn't match the leaf's parameters
+        arg_count_mismatch,
+        arg_type_mismatch,
+        result_type_mismatch,
+        //! None of the calls were suitable for inlining
+        nothing_selected,
+        count
+    };
+
+    //! The this pointer adjustment made by a C++ virtual function
+    //! thunk before it jumps to the overriding function
+    struct thunk_info
+    {
+        //! The thunk's entry point, as found in vtables
+        const void* address = nullptr;
+        //! Added to the this pointer first
+        int64_t fixed_offset = 0;
+        //! If non-zero, the position relative to the adjusted
+        //! object's vtable pointer of a further offset to add
+        int64_t vcall_offset = 0;
+    };
+
+    //! One vtable as seen from the objects that use it. A vtable group
+    //! for a class with several dynamic bases has one of these per
+    //! base subobject
+    struct vtable_info
+    {
+        //! Where an object's vtable pointer points, i.e. the first
+        //! function slot, just after the typeinfo pointer. Null for a
+        //! layout that the decorate pass didn't recognise
+        const void* const* address_point = nullptr;
+        //! Number of function slots from the address point
+        size_t slots = 0;
+    };
+
+    //! One entry in a module's symbol index
+    struct symbol_info
+    {
+        //! Name of a global or function as it appears in the bitcode
+        const char* name = nullptr;
+        //! Its position in reflect::globals
+        size_t global = 0;
+    };
+
     //! Runtime access to the bitcode
     struct reflect
     {
@@ -56,8 +138,24 @@ namespace drti
         void* const* globals = 0;
         //! Number of globals in the array
         size_t globals_size = 0;
+        //! Pointer to the array of virtual function thunks in the
+        //! module
+        const thunk_info* thunks = 0;
+        //! Number of thunks in the array
+        size_t thunks_size = 0;
+        //! Pointer to the array of vtables defined in the module
+        const vtable_info* vtables = 0;
+        //! Number of vtables in the array
+        size_t vtables_size = 0;
+        //! Index of the globals array by name, sorted by byte-wise
+        //! comparison of the names
+        const symbol_info* symbols = 0;
+        //! Number of entries in the index
+        size_t symbols_size = 0;
     };
 
+    struct static_callsite;
+
     //! Function entry point accounting
     struct landing_site
     {
@@ -69,6 +167,14 @@ namespace drti
         const char* function_name = 0;
         //! Link to the bitcode for the containing module
         reflect* self = nullptr;
+        //! Pointer to the array of decorated call sites within the
+        //! function, in order of call_number
+        static_callsite* const* callsites = nullptr;
+        //! Number of call sites in the array
+        size_t callsites_size = 0;
+        //! Address of the function, which differs from a call's
+        //! target if the call went via a thunk
+        const void* function = nullptr;
     };
 
     struct treenode;
@@ -92,6 +198,16 @@ namespace drti
         std::vector<std::unique_ptr<treenode>> nodes;
     };
 
+    //! Value profile for one pointer argument, recorded on landing
+    struct arg_profile
+    {
+        //! The first value seen, set once by whichever thread lands
+        //! first
+        _Atomic(const void*) value = nullptr;
+        //! Number of landings with that same value
+        counter_t same = 0;
+    };
+
     //! A node in a call tree, representing one (parent, target) pair
     //! from one static callsite
     struct treenode
@@ -115,13 +231,89 @@ namespace drti
         //! theory it would be possible for one target address to arrive
         //! at different landing sites, if the call goes via a thunk that
         //! can change destination. Does that actually exist in practice?
-        landing_site* landing;
+        //! C++ this-adjusting thunks jump to a fixed function, and
+        //! land there with the thunk's caller. Set by the application
+        //! thread that lands first, and cleared by the runtime to have
+        //! the next call come back to inspect_treenode
+        _Atomic(landing_site*) landing;
+        //! Downwards in the chain, i.e. nodes with this one as parent,
+        //! linked through next_sibling. Application threads only ever
+        //! push onto the front, atomically, so the compiler can walk
+        //! the list while it grows
+        _Atomic(treenode*) children = nullptr;
+        //! The next node with the same parent, fixed once the node is
+        //! in its parent's list
+        treenode* next_sibling = nullptr;
+        //! Profiles of the first profiled_args pointer arguments in
+        //! calls via this node (see is_profiled_argument)
+        arg_profile args[profiled_args];
+        //! For virtual calls, the first vtable pointer seen in the
+        //! receiver object
+        _Atomic(const void*) receiver_vtable = nullptr;
+        //! Recompilation of the call chain ending at this node
+        atomic_compile_state state = compile_state::unseen;
     };
 
     //! Called by the client for treenodes that may be of interest.
     //! At the moment this attempts to compile the functions in the
     //! call chain immediately.
     DRTI_PUBLIC void inspect_treenode(treenode*);
+
+    //! Printable name of a treenode's compile state, for monitoring
+    DRTI_PUBLIC const char* compile_state_name(compile_state);
+
+    //! Number of failed compilations for the given reason
+    DRTI_PUBLIC int64_t compile_failures(failure_reason);
+
+    //! Number of compilations skipped or cut short because an
+    //! earlier attempt failed in the same way
+    DRTI_PUBLIC int64_t compiles_skipped();
+
+    //! Printable name of a failure_reason
+    DRTI_PUBLIC const char* failure_reason_name(failure_reason);
+
+    //! Number of guards in all the recompiled code installed so far
+    DRTI_PUBLIC int64_t guards_installed();
+
+    //! Number of virtual calls in the recompiled code installed so
+    //! far that go direct to their only loaded implementation,
+    //! without a guard
+    DRTI_PUBLIC int64_t calls_devirtualised();
+
+    //! Number of pointer arguments that the recompiled code installed
+    //! so far specialises on (see DRTI_MIN_ARG_SAMPLES)
+    DRTI_PUBLIC int64_t arguments_specialised();
+
+    //! Called by each decorated module when it is loaded, making its
+    //! classes known to the runtime
+    DRTI_PUBLIC void register_module(reflect*);
+
+    //! Declares that the size bytes at address won't change again,
+    //! typically a global set up at startup. Recompiled code that
+    //! reads a global entirely within a frozen range uses its
+    //! current value as a constant. Freezing an already frozen
+    //! address thaws it first.
+    DRTI_PUBLIC void freeze_range(const void* address, size_t size);
+
+    //! Ends the freeze starting at address. Recompiled code using
+    //! the frozen values is uninstalled and compiled again later.
+    DRTI_PUBLIC void thaw_range(const void* address);
+
+    //! Freezes each of a set of global variables
+    template<typename... Types>
+    void freeze(const Types&... variables)
+    {
+        int expand[] = {0, (freeze_range(&variables, sizeof(variables)), 0)...};
+        (void) expand;
+    }
+
+    //! Thaws each of a set of global variables frozen by freeze
+    template<typename... Types>
+    void thaw(const Types&... variables)
+    {
+        int expand[] = {0, (thaw_range(&variables), 0)...};
+        (void) expand;
+    }
 }
 
 #endif // runtime_rmg_20191125_included
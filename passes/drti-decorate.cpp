@@ -41,10 +41,12 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include <drti/runtime.hpp>
 #include <drti/drti-common.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <istream>
 #include <optional>
@@ -124,6 +126,9 @@ namespace drti
         llvm::StructType* m_drti_reflect_type;
         llvm::Function* m_drti_landed;
         llvm::Function* m_drti_call_from;
+        llvm::Function* m_drti_call_from_virtual;
+        llvm::Function* m_drti_profile_arg;
+        llvm::Function* m_drti_register_module;
     };
 
     class DecoratePass
@@ -140,15 +145,24 @@ namespace drti
         bool lookup_helpers();
 
         void create_self();
+        void add_registration();
         void add_landing_globals();
         llvm::GlobalVariable* create_landing_global(llvm::Function* const);
         llvm::GlobalVariable* create_callsite_global(
             llvm::Function* const,
             llvm::GlobalVariable* landing_global,
             unsigned call_number);
+        void set_landing_callsites(
+            llvm::Function* const,
+            llvm::GlobalVariable* landing_global,
+            const std::vector<llvm::GlobalVariable*>& callsites);
 
     private:
         llvm::SmallVector<llvm::GlobalValue*, 10> collect_globals();
+        llvm::SmallVector<llvm::Constant*, 0> collect_thunks();
+        llvm::SmallVector<llvm::Constant*, 0> collect_vtables();
+        llvm::SmallVector<llvm::Constant*, 0> collect_symbols(
+            const llvm::SmallVectorImpl<llvm::GlobalValue*>& globals);
         llvm::SmallVector<char, 0> raw_bitcode();
 
         llvm::Value* add_landing_update(
@@ -159,7 +173,7 @@ namespace drti
         std::vector<std::pair<unsigned, llvm::CallBase*>> collect_calls(
             llvm::Function* function);
 
-        void decorate_calls(
+        std::vector<llvm::GlobalVariable*> decorate_calls(
             const std::vector<std::pair<unsigned, llvm::CallBase*>>& collected,
             llvm::Value*, llvm::GlobalVariable*);
 
@@ -259,9 +273,8 @@ llvm::SmallVector<llvm::GlobalValue*, 10> drti::DecoratePass::collect_globals()
         }
         else if(function.isDeclaration())
         {
-            // Save declarations for runtime global resolution
-            // IMPORTANT - filtering here must match the same
-            // functions as in globalsMap from runtime.cpp
+            // Save declarations for runtime global resolution,
+            // which finds them by name via collect_symbols
             DEBUG_WITH_TYPE("drti", llvm::dbgs() << "drti: noting extern " << function.getName() << "\n");
             result.push_back(&function);
         }
@@ -279,6 +292,243 @@ llvm::SmallVector<llvm::GlobalValue*, 10> drti::DecoratePass::collect_globals()
     return result;
 }
 
+//! Parses one Itanium ABI <nv-offset> or <v-offset> number, with its
+//! terminating underscore, from the front of name
+static bool consume_thunk_offset(llvm::StringRef& name, int64_t& offset)
+{
+    bool negative = name.consume_front("n");
+    unsigned long long value;
+    if(name.consumeInteger(10, value) || !name.consume_front("_"))
+    {
+        return false;
+    }
+    offset = static_cast<int64_t>(value);
+    if(negative)
+    {
+        offset = -offset;
+    }
+    return true;
+}
+
+//! Recovers the this adjustment from the mangled name of a
+//! this-adjusting thunk, e.g. _ZThn16_N7Derived3fooEv subtracts 16
+//! and _ZTv0_n24_N7Derived3fooEv adds the offset at vtable - 24.
+//! Covariant return thunks (_ZTc) also adjust the result and are not
+//! handled
+static bool parse_thunk_name(
+    llvm::StringRef name, int64_t& fixed_offset, int64_t& vcall_offset)
+{
+    fixed_offset = 0;
+    vcall_offset = 0;
+    if(name.consume_front("_ZTh"))
+    {
+        return consume_thunk_offset(name, fixed_offset);
+    }
+    else if(name.consume_front("_ZTv"))
+    {
+        return consume_thunk_offset(name, fixed_offset)
+            && consume_thunk_offset(name, vcall_offset);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+//! The layout of thunk_info
+static llvm::StructType* thunk_type(llvm::Module& module)
+{
+    llvm::Type* int64 = llvm::IntegerType::get(module.getContext(), 64);
+    llvm::Type* members[] = {
+        llvm::IntegerType::get(module.getContext(), 8)->getPointerTo(),
+        int64,
+        int64
+    };
+    return llvm::StructType::get(module.getContext(), members);
+}
+
+llvm::SmallVector<llvm::Constant*, 0> drti::DecoratePass::collect_thunks()
+{
+    // The runtime uses these to convert the receiver of a virtual
+    // call when inlining the function that the thunk jumps to. That
+    // needs no class hierarchy information: the vtable slot already
+    // selected the override and the thunk name tells us how to reach
+    // its this pointer. Declarations are useful too, since their
+    // names are enough
+    llvm::SmallVector<llvm::Constant*, 0> result;
+    llvm::StructType* type = thunk_type(m_module);
+
+    for(llvm::Function& function: m_module.functions())
+    {
+        int64_t fixed_offset;
+        int64_t vcall_offset;
+        if(parse_thunk_name(function.getName(), fixed_offset, vcall_offset))
+        {
+            DEBUG_WITH_TYPE(
+                "drti",
+                llvm::dbgs() << "drti: noting thunk " << function.getName()
+                << " " << fixed_offset << " " << vcall_offset << "\n");
+
+            llvm::Constant* members[] = {
+                llvm::ConstantExpr::getBitCast(
+                    &function, type->getElementType(0)),
+                llvm::ConstantInt::get(type->getElementType(1), fixed_offset),
+                llvm::ConstantInt::get(type->getElementType(2), vcall_offset)
+            };
+            result.push_back(llvm::ConstantStruct::get(type, members));
+        }
+    }
+
+    return result;
+}
+
+//! The layout of vtable_info
+static llvm::StructType* vtable_type(llvm::Module& module)
+{
+    llvm::Type* members[] = {
+        llvm::IntegerType::get(module.getContext(), 8)
+            ->getPointerTo()->getPointerTo(),
+        llvm::IntegerType::get(module.getContext(), 64)
+    };
+    return llvm::StructType::get(module.getContext(), members);
+}
+
+llvm::SmallVector<llvm::Constant*, 0> drti::DecoratePass::collect_vtables()
+{
+    // Clang emits a vtable group as a structure with one array per
+    // vtable, each with its function slots after the typeinfo
+    // pointer. The runtime gets the class from the typeinfo, so we
+    // only need the address points. Anything else gets a null entry,
+    // which tells the runtime that the set of classes is incomplete
+    llvm::SmallVector<llvm::Constant*, 0> result;
+    llvm::StructType* type = vtable_type(m_module);
+    llvm::Type* int32 = llvm::IntegerType::get(m_module.getContext(), 32);
+
+    auto unknown = [&]() {
+        result.push_back(llvm::Constant::getNullValue(type));
+    };
+
+    for(llvm::GlobalVariable& variable: m_module.globals())
+    {
+        if(variable.isDeclaration() || !variable.getName().startswith("_ZTV"))
+        {
+            continue;
+        }
+
+        auto group = llvm::dyn_cast<llvm::ConstantStruct>(
+            variable.getInitializer());
+        if(!group)
+        {
+            unknown();
+            continue;
+        }
+
+        for(unsigned index = 0; index < group->getNumOperands(); ++index)
+        {
+            auto table = llvm::dyn_cast<llvm::ConstantArray>(
+                group->getOperand(index));
+            unsigned typeinfo = 0;
+            while(table && typeinfo < table->getNumOperands())
+            {
+                auto global = llvm::dyn_cast<llvm::GlobalVariable>(
+                    table->getOperand(typeinfo)->stripPointerCasts());
+                if(global && global->getName().startswith("_ZTI"))
+                {
+                    break;
+                }
+                ++typeinfo;
+            }
+
+            if(!table || typeinfo == table->getNumOperands())
+            {
+                unknown();
+                continue;
+            }
+
+            llvm::Constant* indices[] = {
+                llvm::ConstantInt::get(int32, 0),
+                llvm::ConstantInt::get(int32, index),
+                llvm::ConstantInt::get(int32, typeinfo + 1)
+            };
+            llvm::Constant* address_point =
+                llvm::ConstantExpr::getInBoundsGetElementPtr(
+                    group->getType(), &variable, indices);
+
+            llvm::Constant* members[] = {
+                llvm::ConstantExpr::getBitCast(
+                    address_point, type->getElementType(0)),
+                llvm::ConstantInt::get(
+                    type->getElementType(1),
+                    table->getNumOperands() - typeinfo - 1)
+            };
+            result.push_back(llvm::ConstantStruct::get(type, members));
+        }
+    }
+
+    return result;
+}
+
+//! The layout of symbol_info
+static llvm::StructType* symbol_type(llvm::Module& module)
+{
+    llvm::Type* members[] = {
+        llvm::IntegerType::get(module.getContext(), 8)->getPointerTo(),
+        llvm::IntegerType::get(module.getContext(), 64)
+    };
+    return llvm::StructType::get(module.getContext(), members);
+}
+
+llvm::SmallVector<llvm::Constant*, 0> drti::DecoratePass::collect_symbols(
+    const llvm::SmallVectorImpl<llvm::GlobalValue*>& globals)
+{
+    // The runtime binary searches this to resolve the symbols that
+    // the JIT asks for, instead of working out the order of the
+    // globals array and mapping every name on each compilation. The
+    // names all go in one string table
+    std::vector<std::pair<llvm::StringRef, size_t>> sorted;
+    for(size_t index = 0; index < globals.size(); ++index)
+    {
+        sorted.emplace_back(globals[index]->getName(), index);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string names;
+    std::vector<size_t> offsets;
+    for(const auto& entry: sorted)
+    {
+        offsets.push_back(names.size());
+        names.append(entry.first.data(), entry.first.size());
+        names.push_back('\0');
+    }
+
+    llvm::Constant* table = llvm::ConstantDataArray::getString(
+        m_module.getContext(), names, false);
+    auto names_variable = new llvm::GlobalVariable(
+        m_module,
+        table->getType(), true, llvm::GlobalValue::PrivateLinkage,
+        table, "__drti_symbol_names");
+
+    llvm::SmallVector<llvm::Constant*, 0> result;
+    llvm::StructType* type = symbol_type(m_module);
+    llvm::Type* int64 = llvm::IntegerType::get(m_module.getContext(), 64);
+
+    for(size_t index = 0; index < sorted.size(); ++index)
+    {
+        llvm::Constant* indices[] = {
+            llvm::ConstantInt::get(int64, 0),
+            llvm::ConstantInt::get(int64, offsets[index])
+        };
+        llvm::Constant* members[] = {
+            llvm::ConstantExpr::getInBoundsGetElementPtr(
+                table->getType(), names_variable, indices),
+            llvm::ConstantInt::get(int64, sorted[index].second)
+        };
+        result.push_back(llvm::ConstantStruct::get(type, members));
+    }
+
+    return result;
+}
+
 bool drti::DecoratePass::find_target_functions()
 {
     for(llvm::Function& function: m_module.functions())
@@ -358,7 +608,13 @@ drti::InlineHelpers::InlineHelpers(llvm::Module& module) :
     m_drti_landed(
         module.getFunction("_drti_landed")),
     m_drti_call_from(
-        module.getFunction("_drti_call_from"))
+        module.getFunction("_drti_call_from")),
+    m_drti_call_from_virtual(
+        module.getFunction("_drti_call_from_virtual")),
+    m_drti_profile_arg(
+        module.getFunction("_drti_profile_arg")),
+    m_drti_register_module(
+        module.getFunction("_drti_register_module"))
 {
     // Check that the compile-time structure types in tree.hpp haven't
     // changed since we hard-coded their setup here
@@ -366,11 +622,30 @@ drti::InlineHelpers::InlineHelpers(llvm::Module& module) :
     CHECK_MEMBER_P(reflect, module_size, size_t, module);
     CHECK_MEMBER_P(reflect, globals, void* const*, module_size);
     CHECK_MEMBER_P(reflect, globals_size, size_t, globals);
+    CHECK_MEMBER_P(reflect, thunks, const thunk_info*, globals_size);
+    CHECK_MEMBER_P(reflect, thunks_size, size_t, thunks);
+    CHECK_MEMBER_P(reflect, vtables, const vtable_info*, thunks_size);
+    CHECK_MEMBER_P(reflect, vtables_size, size_t, vtables);
+    CHECK_MEMBER_P(reflect, symbols, const symbol_info*, vtables_size);
+    CHECK_MEMBER_P(reflect, symbols_size, size_t, symbols);
+
+    CHECK_MEMBER(symbol_info, name, const char*, 0);
+    CHECK_MEMBER_P(symbol_info, global, size_t, name);
+
+    CHECK_MEMBER(thunk_info, address, const void*, 0);
+    CHECK_MEMBER_P(thunk_info, fixed_offset, int64_t, address);
+    CHECK_MEMBER_P(thunk_info, vcall_offset, int64_t, fixed_offset);
+
+    CHECK_MEMBER(vtable_info, address_point, const void* const*, 0);
+    CHECK_MEMBER_P(vtable_info, slots, size_t, address_point);
 
     CHECK_MEMBER(landing_site, total_called, counter_t, 0);
     CHECK_MEMBER_P(landing_site, global_name, const char*, total_called);
     CHECK_MEMBER_P(landing_site, function_name, const char*, global_name);
     CHECK_MEMBER_P(landing_site, self, reflect*, function_name);
+    CHECK_MEMBER_P(landing_site, callsites, static_callsite* const*, self);
+    CHECK_MEMBER_P(landing_site, callsites_size, size_t, callsites);
+    CHECK_MEMBER_P(landing_site, function, const void*, callsites_size);
 }
 
 bool drti::InlineHelpers::ok() const
@@ -384,7 +659,11 @@ bool drti::InlineHelpers::ok() const
             "drti", llvm::dbgs() << "drti: type(s) not found in module\n");
         return false;
     }
-    else if (!m_drti_landed || !m_drti_call_from)
+    else if (!m_drti_landed
+             || !m_drti_call_from
+             || !m_drti_call_from_virtual
+             || !m_drti_profile_arg
+             || !m_drti_register_module)
     {
         DEBUG_WITH_TYPE(
             "drti", llvm::dbgs() << "drti: support function(s) not found in module\n");
@@ -463,7 +742,40 @@ void drti::DecoratePass::create_self()
     llvm::Constant* cast_globals = llvm::ConstantExpr::getBitCast(
         globals_variable, void_star->getPointerTo());
 
-    llvm::Constant* reflect_members[4] = {
+    llvm::SmallVector<llvm::Constant*, 0> thunks(collect_thunks());
+
+    llvm::Constant* thunks_array = llvm::ConstantArray::get(
+        llvm::ArrayType::get(thunk_type(m_module), thunks.size()),
+        llvm::makeArrayRef(thunks.data(), thunks.size()));
+
+    auto thunks_variable = new llvm::GlobalVariable(
+        m_module,
+        thunks_array->getType(), true, llvm::GlobalValue::InternalLinkage,
+        thunks_array, "__drti_thunks");
+
+    llvm::SmallVector<llvm::Constant*, 0> vtables(collect_vtables());
+
+    llvm::Constant* vtables_array = llvm::ConstantArray::get(
+        llvm::ArrayType::get(vtable_type(m_module), vtables.size()),
+        llvm::makeArrayRef(vtables.data(), vtables.size()));
+
+    auto vtables_variable = new llvm::GlobalVariable(
+        m_module,
+        vtables_array->getType(), true, llvm::GlobalValue::InternalLinkage,
+        vtables_array, "__drti_vtables");
+
+    llvm::SmallVector<llvm::Constant*, 0> symbols(collect_symbols(globals));
+
+    llvm::Constant* symbols_array = llvm::ConstantArray::get(
+        llvm::ArrayType::get(symbol_type(m_module), symbols.size()),
+        llvm::makeArrayRef(symbols.data(), symbols.size()));
+
+    auto symbols_variable = new llvm::GlobalVariable(
+        m_module,
+        symbols_array->getType(), true, llvm::GlobalValue::InternalLinkage,
+        symbols_array, "__drti_symbols");
+
+    llvm::Constant* reflect_members[10] = {
         cast_bitcode,
         llvm::ConstantInt::get(
             llvm::IntegerType::get(
@@ -472,6 +784,21 @@ void drti::DecoratePass::create_self()
         llvm::ConstantInt::get(
             llvm::IntegerType::get(
                 m_module.getContext(), 64), extern_addresses.size()),
+        llvm::ConstantExpr::getBitCast(
+            thunks_variable, m_inline->m_drti_reflect_type->getElementType(4)),
+        llvm::ConstantInt::get(
+            llvm::IntegerType::get(
+                m_module.getContext(), 64), thunks.size()),
+        llvm::ConstantExpr::getBitCast(
+            vtables_variable, m_inline->m_drti_reflect_type->getElementType(6)),
+        llvm::ConstantInt::get(
+            llvm::IntegerType::get(
+                m_module.getContext(), 64), vtables.size()),
+        llvm::ConstantExpr::getBitCast(
+            symbols_variable, m_inline->m_drti_reflect_type->getElementType(8)),
+        llvm::ConstantInt::get(
+            llvm::IntegerType::get(
+                m_module.getContext(), 64), symbols.size()),
     };
 
     llvm::Constant* reflect_constant =
@@ -488,6 +815,26 @@ void drti::DecoratePass::create_self()
         << buffer.size() << "\n");
 }
 
+void drti::DecoratePass::add_registration()
+{
+    // Tell the runtime about the module as soon as it is loaded, so
+    // that it knows about every class with a vtable here, even before
+    // any of its functions get called
+    llvm::Function* registration = llvm::Function::Create(
+        llvm::FunctionType::get(
+            llvm::Type::getVoidTy(m_module.getContext()), false),
+        llvm::GlobalValue::InternalLinkage,
+        "__drti_register",
+        m_module);
+
+    llvm::IRBuilder<> builder(
+        llvm::BasicBlock::Create(m_module.getContext(), "", registration));
+    builder.CreateCall(m_inline->m_drti_register_module, {m_reflect_global});
+    builder.CreateRetVoid();
+
+    llvm::appendToGlobalCtors(m_module, registration, 65535);
+}
+
 llvm::Value* drti::DecoratePass::add_landing_update(
     llvm::Function* function,
     llvm::GlobalVariable* landing_global)
@@ -515,6 +862,8 @@ llvm::Value* drti::DecoratePass::add_landing_update(
     //
     // drti_land3:
     //    treenode = _drti_caller()
+    //    call _drti_profile_arg(treenode, 0, first pointer argument)
+    //    ...
     //    call _drti_landed(landing_global, treenode)
     //    br drti_land1
 
@@ -614,6 +963,24 @@ llvm::Value* drti::DecoratePass::add_landing_update(
     llvm::Value* treenode = builder.CreateCall(
         drtiCaller, llvm::None, "drtiTreenode");
 
+    // Value profiling for the runtime to specialise on stable
+    // pointer arguments, only done for calls that have a caller
+    unsigned slot = 0;
+    for(llvm::Argument& argument: function->args())
+    {
+        if(slot < profiled_args && is_profiled_argument(argument))
+        {
+            llvm::Value* profileArgs[] = {
+                treenode,
+                llvm::ConstantInt::get(
+                    llvm::IntegerType::get(m_module.getContext(), 32), slot),
+                builder.CreateBitCast(&argument, voidpType)
+            };
+            builder.CreateCall(m_inline->m_drti_profile_arg, profileArgs);
+            ++slot;
+        }
+    }
+
     llvm::Value* arguments[] = { landing_global, treenode };
 
     DEBUG_WITH_TYPE(
@@ -649,12 +1016,30 @@ void drti::DecoratePass::decorate_call(
     llvm::Value* oldTarget = builder.CreateBitCast(
         callInst->getCalledOperand(), void_ptr_ty, "castOldTarget");
 
-    llvm::Value* callFromArgs[] = {
-        callsite, caller, oldTarget
-    };
+    llvm::Value* treenode;
 
-    llvm::Value* treenode = builder.CreateCall(
-        m_inline->m_drti_call_from, callFromArgs, "treenode");
+    if(llvm::LoadInst* vtable = virtual_call_vtable(*callInst))
+    {
+        // Virtual calls also record the receiver's vtable pointer, so
+        // the runtime can guard inlined code with a check that covers
+        // every call on the same object
+        llvm::Value* callFromArgs[] = {
+            callsite, caller, oldTarget,
+            builder.CreateBitCast(vtable, void_ptr_ty, "castVtable")
+        };
+
+        treenode = builder.CreateCall(
+            m_inline->m_drti_call_from_virtual, callFromArgs, "treenode");
+    }
+    else
+    {
+        llvm::Value* callFromArgs[] = {
+            callsite, caller, oldTarget
+        };
+
+        treenode = builder.CreateCall(
+            m_inline->m_drti_call_from, callFromArgs, "treenode");
+    }
 
     // We do two things here - replace the target of the call with the
     // (casted) treenode's resolved_target function pointer and pass
@@ -765,7 +1150,7 @@ std::vector<std::pair<unsigned, llvm::CallBase*>> drti::DecoratePass::collect_ca
     return result;
 }
 
-void drti::DecoratePass::decorate_calls(
+std::vector<llvm::GlobalVariable*> drti::DecoratePass::decorate_calls(
     const std::vector<std::pair<unsigned, llvm::CallBase*>>& collected,
     llvm::Value* caller,
     llvm::GlobalVariable* landing_global)
@@ -775,6 +1160,8 @@ void drti::DecoratePass::decorate_calls(
     // call_target) and replace the call target with the return
     // value. Our caller is determined from our own landing site code.
 
+    std::vector<llvm::GlobalVariable*> result;
+
     for(const auto& [call_number, callInst]: collected)
     {
         llvm::GlobalVariable* callsite_global(
@@ -784,7 +1171,11 @@ void drti::DecoratePass::decorate_calls(
                 call_number));
 
         decorate_call(caller, callInst, callsite_global);
+
+        result.push_back(callsite_global);
     }
+
+    return result;
 }
 
 void drti::DecoratePass::add_landing_globals()
@@ -811,7 +1202,10 @@ void drti::DecoratePass::add_landing_globals()
 
             llvm::Value* caller = add_landing_update(function, landing_global);
 
-            decorate_calls(calls, caller, landing_global);
+            std::vector<llvm::GlobalVariable*> callsites(
+                decorate_calls(calls, caller, landing_global));
+
+            set_landing_callsites(function, landing_global, callsites);
 
             // prints to dbgs()
             llvm::FunctionAnalysisManager DummyFAM;
@@ -862,7 +1256,17 @@ llvm::GlobalVariable* drti::DecoratePass::create_landing_global(
             function_name_global,
             llvm::IntegerType::get(m_module.getContext(), 8)->getPointerTo()),
         // self
-        m_reflect_global
+        m_reflect_global,
+        // callsites (see set_landing_callsites)
+        llvm::ConstantPointerNull::get(
+            llvm::cast<llvm::PointerType>(
+                m_inline->m_drti_landing_site_type->getElementType(4))),
+        // callsites_size
+        zero,
+        // function
+        llvm::ConstantExpr::getBitCast(
+            function,
+            m_inline->m_drti_landing_site_type->getElementType(6))
     };
 
     llvm::Constant* landing_site_constant =
@@ -915,6 +1319,52 @@ llvm::GlobalVariable* drti::DecoratePass::create_callsite_global(
     return variable;
 }
 
+void drti::DecoratePass::set_landing_callsites(
+    llvm::Function* const function,
+    llvm::GlobalVariable* landing_global,
+    const std::vector<llvm::GlobalVariable*>& callsites)
+{
+    // The callsites refer to their landing site so we can only fill
+    // in the landing site's array of callsites once they exist
+    llvm::PointerType* callsite_pointer_type =
+        m_inline->m_drti_callsite_type->getPointerTo();
+
+    llvm::SmallVector<llvm::Constant*, 0> callsite_addresses(
+        callsites.begin(), callsites.end());
+
+    llvm::Constant* callsites_array = llvm::ConstantArray::get(
+        llvm::ArrayType::get(
+            callsite_pointer_type, callsite_addresses.size()),
+        llvm::makeArrayRef(
+            callsite_addresses.data(), callsite_addresses.size()));
+
+    auto callsites_variable = new llvm::GlobalVariable(
+        m_module,
+        callsites_array->getType(), true, llvm::GlobalValue::InternalLinkage,
+        callsites_array,
+        "_drti_callsites_" + function->getName().str());
+
+    auto landing_constant = llvm::cast<llvm::ConstantStruct>(
+        landing_global->getInitializer());
+
+    llvm::SmallVector<llvm::Constant*, 7> landing_site_members;
+    for(unsigned index = 0; index < landing_constant->getNumOperands(); ++index)
+    {
+        landing_site_members.push_back(landing_constant->getOperand(index));
+    }
+
+    landing_site_members[4] = llvm::ConstantExpr::getBitCast(
+        callsites_variable,
+        m_inline->m_drti_landing_site_type->getElementType(4));
+    landing_site_members[5] = llvm::ConstantInt::get(
+        llvm::IntegerType::get(m_module.getContext(), 64),
+        callsite_addresses.size());
+
+    landing_global->setInitializer(
+        llvm::ConstantStruct::get(
+            m_inline->m_drti_landing_site_type, landing_site_members));
+}
+
 llvm::PreservedAnalyses drti::Decorate::run(
     llvm::Module& module, llvm::ModuleAnalysisManager&)
 {
@@ -960,6 +1410,7 @@ bool drti::Decorate::runOnModule(llvm::Module& module)
     // Unfortunately this will include the support module which we
     // really don't want in the JIT-time compilation
     decorator.create_self();
+    decorator.add_registration();
 
     decorator.add_landing_globals();
 //    decorator.set_initializers();
@@ -84,6 +84,18 @@ DRTI_INLINE_SUPPORT treenode* _drti_lookup_or_insert(
                                      
     site.nodes.emplace_back(std::move(new_node));
 
+    if(caller)
+    {
+        // The runtime may be reading the list on another thread
+        treenode* child = site.nodes.back().get();
+        treenode* first = atomic_load(&caller->children);
+        do
+        {
+            child->next_sibling = first;
+        }
+        while(!atomic_compare_exchange_weak(&caller->children, &first, child));
+    }
+
     return site.nodes.back().get();
 }
 
@@ -97,6 +109,57 @@ DRTI_INLINE_SUPPORT treenode* _drti_call_from(
     return &node;
 }
 
+DRTI_INLINE_SUPPORT treenode* _drti_call_from_virtual(
+    static_callsite& site,
+    treenode* caller,
+    const void* target,
+    const void* vtable)
+{
+    treenode* node = _drti_call_from(site, caller, target);
+
+    if(DRTI_UNLIKELY(
+           !atomic_load_explicit(&node->receiver_vtable, memory_order_relaxed)))
+    {
+        atomic_store_explicit(
+            &node->receiver_vtable, vtable, memory_order_relaxed);
+    }
+
+    return node;
+}
+
+DRTI_INLINE_SUPPORT void _drti_profile_arg(
+    treenode* caller, unsigned index, const void* value)
+{
+    if(DRTI_UNLIKELY(!caller))
+    {
+        return;
+    }
+
+    arg_profile& profile(caller->args[index]);
+
+    const void* first =
+        atomic_load_explicit(&profile.value, memory_order_relaxed);
+    if(DRTI_UNLIKELY(!first)
+       && atomic_compare_exchange_strong_explicit(
+           &profile.value, &first, value,
+           memory_order_relaxed, memory_order_relaxed))
+    {
+        // Otherwise another thread got there first, and first is now
+        // its value. We only want one likely value either way
+        first = value;
+    }
+
+    if(DRTI_LIKELY(first == value))
+    {
+        DRTI_ATOMIC_INC(profile.same);
+    }
+}
+
+DRTI_INLINE_SUPPORT void _drti_register_module(reflect* self)
+{
+    register_module(self);
+}
+
 DRTI_INLINE_SUPPORT void _drti_landed(landing_site& site, treenode* caller)
 {
     DRTI_ATOMIC_INC(site.total_called);
@@ -106,15 +169,18 @@ DRTI_INLINE_SUPPORT void _drti_landed(landing_site& site, treenode* caller)
     // no caller information.
     if(DRTI_UNLIKELY(caller))
     {
-        if(DRTI_LIKELY(caller->landing))
+        landing_site* landing =
+            atomic_load_explicit(&caller->landing, memory_order_acquire);
+        if(DRTI_LIKELY(landing))
         {
-            assert(caller->landing == &site);
+            assert(landing == &site);
         }
         else
         {
             assert(caller->caller_abi_version == abi_version);
             // TODO - detect landing after jumps from tail-optimized calls
-            caller->landing = &site;
+            atomic_store_explicit(
+                &caller->landing, &site, memory_order_release);
             inspect_treenode(caller);
         }
     }
@@ -0,0 +1,45 @@
+// -*- mode:c++ -*-
+//
+// Module bench_stub.cpp
+//
+// Stands in for the runtime library in the microbench-stub build, so
+// that decorated code runs its profiling calls but never gets
+// recompiled. The difference from the plain build is the cost of
+// _drti_call_from and _drti_landed
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include <drti/runtime.hpp>
+
+namespace drti
+{
+    void inspect_treenode(treenode*);
+    void register_module(reflect*);
+}
+
+void drti::inspect_treenode(treenode*)
+{
+}
+
+void drti::register_module(reflect*)
+{
+}
@@ -0,0 +1,62 @@
+# -*- mode:awk -*-
+#
+# Script bench_summary.awk
+#
+# Combines the microbench results of the plain, stub and drti
+# variants into one line per workload and thread count. Usage:
+#
+#   awk -F, -f bench_summary.awk RESULTS_FILE
+#
+# Copyright (c) 2026 Raoul M. Gough
+#
+# This file is part of DRTI.
+#
+# DRTI is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, version 3 only.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# History
+# =======
+# 2026/10/18   rmg     File creation
+#
+
+$1 == "variant" { next }
+
+{
+    key = $2 "," $3
+    if(!(key in seen))
+    {
+        seen[key] = 1
+        keys[++count] = key
+    }
+    ns[$1, key] = $4
+    warmup[$1, key] = $5
+}
+
+END {
+    # call_overhead_ns is what _drti_call_from and _drti_landed add
+    # to each call before recompilation, and the speedups compare
+    # recompiled code with the plain and uncompiled versions
+    print "workload,threads,call_overhead_ns,speedup_vs_plain," \
+        "speedup_vs_stub,compile_latency_ns"
+
+    for(i = 1; i <= count; ++i)
+    {
+        key = keys[i]
+        drti = ns["drti", key]
+        printf "%s,%.3f,%.3f,%.3f,%d\n",
+            key,
+            ns["stub", key] - ns["plain", key],
+            drti ? ns["plain", key] / drti : 0,
+            drti ? ns["stub", key] / drti : 0,
+            warmup["drti", key]
+    }
+}
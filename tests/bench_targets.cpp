@@ -0,0 +1,63 @@
+// -*- mode:c++ -*-
+//
+// Module bench_targets.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "bench_targets.hpp"
+
+namespace drti_bench
+{
+    // The leaves do little enough work that call overhead dominates,
+    // which is where inlining pays off
+
+    static int via_pointer(int value)
+    {
+        return value ^ 0x5a;
+    }
+
+    struct doubler : shape
+    {
+        int scale(int value) const override;
+    };
+}
+
+int drti_bench::direct_leaf(int value)
+{
+    return value * 3 + 1;
+}
+
+drti_bench::leaf_function drti_bench::pointer_leaf()
+{
+    return &via_pointer;
+}
+
+int drti_bench::doubler::scale(int value) const
+{
+    return value * 2;
+}
+
+const drti_bench::shape& drti_bench::shape::instance()
+{
+    static const doubler instance;
+    return instance;
+}
@@ -0,0 +1,65 @@
+// -*- mode:c++ -*-
+//
+// Header file bench_targets.hpp
+//
+// Leaf functions for the microbenchmarks in microbench.cpp, kept in
+// their own module so that ahead-of-time compilation can't inline
+// them
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef bench_targets_rmg_20261018_included
+#define bench_targets_rmg_20261018_included
+
+namespace drti_bench
+{
+    using leaf_function = int (*)(int);
+
+    //! Target of the direct calls
+    int direct_leaf(int);
+
+    //! Target of the function pointer calls, which is only reachable
+    //! through the pointer
+    leaf_function pointer_leaf();
+
+    struct shape
+    {
+        virtual ~shape() = default;
+        virtual int scale(int) const = 0;
+
+        //! Target of the virtual calls
+        static const shape& instance();
+    };
+
+    //! Names the type of the virtual calls for drti_test_targets.txt,
+    //! like drti_test::type_matched_function
+    inline int type_matched_function(const shape*, int);
+}
+
+// Never called but needed by name during the DRTI decoration pass
+__attribute__((used)) inline int drti_bench::type_matched_function(
+    const shape*, int)
+{
+    return 0;
+}
+
+#endif // bench_targets_rmg_20261018_included
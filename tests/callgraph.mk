@@ -0,0 +1,109 @@
+# -*- mode:makefile -*-
+#
+# Make include file callgraph.mk
+#
+# Builds and measures a program from callgraph_gen, whose generated
+# Makefile defines DRTI_ROOT and UNITS and then includes this
+#
+# Copyright (c) 2026 Raoul M. Gough
+#
+# This file is part of DRTI.
+#
+# DRTI is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, version 3 only.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# History
+# =======
+# 2026/10/18   rmg     File creation
+#
+
+all: report
+
+include $(DRTI_ROOT)/drti_base.mk
+
+OPT = -O3
+
+DRTI_LIB = $(DRTI_BASE_DIR)passes/libdrti.so
+
+LLVM_OPT_FLAGS += -enable-new-pm -load-pass-plugin=$(DRTI_LIB)
+
+# The same optimization without the decoration pass, to time against
+BASELINE_OPT_FLAGS = -enable-new-pm
+
+LLVM_NM = $(LLVM_EXE_BIN_DIR)/llvm-nm
+
+LLCFLAGS += -load=$(DRTI_LIB)
+
+export DRTI_TARGETS_FILE = drti_test_targets.txt
+
+RESULTS = callgraph_results.csv
+EVENTS = callgraph_events.log
+
+WARMUP_ROUNDS = 100
+ROUNDS = 1000
+
+# Nanoseconds since the epoch
+NOW = date +%s%N
+
+callgraph-plain: $(UNITS:%=%.o)
+	$(LINK.o) $^ -o $@
+
+callgraph-drti: $(UNITS:%=%-drti.o) $(DRTI_BASE_DIR)drti/drtiruntime.so
+	$(LINK.o) $^ -o $@
+
+%-drti.bc: %.bc $(DRTI_LIB) $(DRTI_TARGETS_FILE)
+	$(LLVM_OPT) $(LLVM_OPT_FLAGS) $(OPT) -o $@ $<
+
+# Writes one metric,value line per measurement. The decoration pass
+# runs here rather than via the pattern rule so that we can time all
+# of it together. Its cost is the difference from the same opt run
+# without the plugin, and the bitcode it embeds is the total size of
+# the __drti_bitcode globals in the decorated objects
+report: callgraph-plain $(UNITS:%=%.bc) $(DRTI_LIB)
+	rm -f $(RESULTS) $(EVENTS)
+	echo "metric,value" >$(RESULTS)
+	start=$$($(NOW)); \
+	for unit in $(UNITS); do \
+	    $(LLVM_OPT) $(BASELINE_OPT_FLAGS) $(OPT) -o /dev/null $$unit.bc \
+	        || exit 1; \
+	done; \
+	middle=$$($(NOW)); \
+	for unit in $(UNITS); do \
+	    $(LLVM_OPT) $(LLVM_OPT_FLAGS) $(OPT) -o $$unit-drti.bc $$unit.bc \
+	        || exit 1; \
+	done; \
+	end=$$($(NOW)); \
+	echo "decoration_ms,$$(( \
+	    ((end - middle) - (middle - start)) / 1000000 ))" >>$(RESULTS)
+	$(MAKE) callgraph-drti
+	echo "bitcode_bytes,$$($(LLVM_NM) --print-size --radix=d \
+	    $(UNITS:%=%-drti.o) \
+	    | awk '$$4 == "__drti_bitcode" { n += $$2 } END { print n + 0 }')" \
+	    >>$(RESULTS)
+	echo "object_growth_bytes,$$(( \
+	    $$(cat $(UNITS:%=%-drti.o) | wc -c) \
+	    - $$(cat $(UNITS:%=%.o) | wc -c) ))" >>$(RESULTS)
+	for variant in plain drti; do \
+	    start=$$($(NOW)); \
+	    ./callgraph-$$variant --startup; \
+	    echo "startup_$${variant}_us,$$(( ($$($(NOW)) - start) / 1000 ))" \
+	        >>$(RESULTS); \
+	done
+	./callgraph-plain plain $(WARMUP_ROUNDS) $(ROUNDS) >>$(RESULTS)
+	DRTI_EVENT_LOG=$(EVENTS) \
+	    ./callgraph-drti drti $(WARMUP_ROUNDS) $(ROUNDS) >>$(RESULTS)
+	awk -f $(DRTI_ROOT)/tests/callgraph_events.awk $(EVENTS) >>$(RESULTS)
+	cat $(RESULTS)
+
+CLEANABLE += callgraph-plain callgraph-drti $(RESULTS) $(EVENTS)
+
+include $(DRTI_BASE_DIR)drti_end.mk
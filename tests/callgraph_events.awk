@@ -0,0 +1,61 @@
+# -*- mode:awk -*-
+#
+# Script callgraph_events.awk
+#
+# Summarises the runtime event log (see DRTI_EVENT_LOG) of a
+# callgraph_gen program as metric,value lines
+#
+# Copyright (c) 2026 Raoul M. Gough
+#
+# This file is part of DRTI.
+#
+# DRTI is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, version 3 only.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# History
+# =======
+# 2026/10/18   rmg     File creation
+#
+
+# Lines look like
+#   DRTI 0.012345 compile_finished caller -> leaf [123456] (node 0x...)
+
+$1 != "DRTI" { next }
+
+match($0, /\(node [^)]*\)/) {
+    nodes[substr($0, RSTART, RLENGTH)] = 1
+}
+
+$3 == "compile_finished" && match($0, /\[[0-9]+\]/) {
+    ++compiles
+    compile_ns += substr($0, RSTART + 1, RLENGTH - 2)
+}
+
+$3 == "installed" { ++installed }
+$3 == "failed" { ++failed }
+
+END {
+    count = 0
+    for(node in nodes)
+    {
+        ++count
+    }
+
+    # Nodes that took part in compilation, so excluding the roots
+    print "treenodes," count
+    print "compiles," compiles + 0
+    print "compiles_installed," installed + 0
+    print "compiles_failed," failed + 0
+    print "compile_ms," int(compile_ns / 1000000)
+    print "compiles_per_second," \
+        (compile_ns ? compiles / (compile_ns / 1e9) : 0)
+}
@@ -0,0 +1,400 @@
+// -*- mode:c++ -*-
+//
+// Module callgraph_gen.cpp
+//
+// Generates a synthetic C++ program with a configurable call graph,
+// for measuring how DRTI scales beyond the small test programs.
+// Usage:
+//
+//   callgraph_gen DIRECTORY DRTI_ROOT [OPTION VALUE]...
+//
+// with options
+//
+//   --units N          translation units (default 8)
+//   --functions N      functions per unit (default 32)
+//   --depth N          levels in each call chain (default 4)
+//   --fanout N         call sites in each non-leaf function (default 2)
+//   --polymorphism N   targets at each call site (default 1, direct)
+//   --padding N        extra statements per function (default 8),
+//                      which controls the module sizes
+//   --seed N           for choosing the call targets (default 1)
+//
+// The directory gets the sources, their drti_test_targets.txt and a
+// Makefile that uses callgraph.mk to build and measure them
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace
+{
+    struct shape
+    {
+        int units = 8;
+        int functions = 32;
+        int depth = 4;
+        int fanout = 2;
+        int polymorphism = 1;
+        int padding = 8;
+        int seed = 1;
+    };
+
+    //! Every generated function is unsigned NAME(unsigned)
+    std::string function_name(int unit, int function)
+    {
+        return "cg_u" + std::to_string(unit) + "_f" + std::to_string(function);
+    }
+
+    std::string mangled_name(const std::string& name)
+    {
+        return "_Z" + std::to_string(name.size()) + name + "j";
+    }
+
+    int level(const shape& graph, int function)
+    {
+        return function % graph.depth;
+    }
+
+    //! A function anywhere in the program at the given level
+    std::string random_function(
+        const shape& graph, int level, std::minstd_rand& random)
+    {
+        int unit = random() % graph.units;
+        int per_unit = (graph.functions - 1 - level) / graph.depth + 1;
+        int function = level + graph.depth * int(random() % per_unit);
+        return function_name(unit, function);
+    }
+
+    bool write_file(
+        const std::string& directory,
+        const char* name,
+        const std::string& contents)
+    {
+        std::string path(directory + "/" + name);
+        std::ofstream file(path);
+        file << contents;
+        if(!file.flush())
+        {
+            std::cerr << "callgraph_gen: unable to write " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    //! Arithmetic that the optimizer can't remove, to make the
+    //! function bigger
+    void pad(std::string& body, const shape& graph, int salt)
+    {
+        for(int count = 0; count < graph.padding; ++count)
+        {
+            body +=
+                "    value = value * 1103515245u + "
+                + std::to_string(salt * 7919 + count) + "u;\n"
+                "    value ^= value >> 13;\n";
+        }
+    }
+
+    std::string generate_unit(
+        const shape& graph, int unit, std::minstd_rand& random)
+    {
+        std::string source(
+            "#include \"callgraph.hpp\"\n"
+            "\n");
+
+        for(int function = 0; function < graph.functions; ++function)
+        {
+            int this_level = level(graph, function);
+
+            source +=
+                "__attribute__((noinline)) unsigned "
+                + function_name(unit, function) + "(unsigned value)\n"
+                "{\n";
+
+            pad(source, graph, unit * graph.functions + function);
+
+            if(this_level + 1 < graph.depth)
+            {
+                source += "    unsigned result = value;\n";
+
+                for(int site = 0; site < graph.fanout; ++site)
+                {
+                    std::string argument(
+                        "value + " + std::to_string(site) + "u");
+
+                    if(graph.polymorphism == 1)
+                    {
+                        source +=
+                            "    result += "
+                            + random_function(graph, this_level + 1, random)
+                            + "(" + argument + ");\n";
+                    }
+                    else
+                    {
+                        std::string table("site" + std::to_string(site));
+                        source +=
+                            "    static unsigned (*const " + table
+                            + "[])(unsigned) = {\n";
+                        for(int arm = 0; arm < graph.polymorphism; ++arm)
+                        {
+                            source +=
+                                "        "
+                                + random_function(graph, this_level + 1, random)
+                                + ",\n";
+                        }
+                        source +=
+                            "    };\n"
+                            "    result += " + table + "[value % "
+                            + std::to_string(graph.polymorphism) + "u]("
+                            + argument + ");\n";
+                    }
+                }
+
+                source += "    return result;\n";
+            }
+            else
+            {
+                source += "    return value;\n";
+            }
+
+            source += "}\n\n";
+        }
+
+        return source;
+    }
+
+    std::string generate_header(const shape& graph)
+    {
+        std::string header(
+            "#ifndef callgraph_included\n"
+            "#define callgraph_included\n"
+            "\n");
+
+        for(int unit = 0; unit < graph.units; ++unit)
+        {
+            for(int function = 0; function < graph.functions; ++function)
+            {
+                header +=
+                    "unsigned " + function_name(unit, function)
+                    + "(unsigned);\n";
+            }
+        }
+
+        // Calls made in one pass over the roots, which are the level 0
+        // functions
+        unsigned long per_root = 0;
+        unsigned long calls = 1;
+        for(int depth = 1; depth < graph.depth; ++depth)
+        {
+            calls *= graph.fanout;
+            per_root += calls;
+        }
+        unsigned long roots =
+            graph.units * ((graph.functions - 1) / graph.depth + 1);
+
+        header +=
+            "\n"
+            "constexpr unsigned long calls_per_round = "
+            + std::to_string(roots * (per_root + 1)) + "ul;\n"
+            "\n"
+            "#endif\n";
+
+        return header;
+    }
+
+    std::string generate_main(const shape& graph)
+    {
+        std::string source(
+            "#include \"callgraph.hpp\"\n"
+            "\n"
+            "#include <chrono>\n"
+            "#include <cstdlib>\n"
+            "#include <cstring>\n"
+            "#include <iostream>\n"
+            "\n"
+            "__attribute__((noinline)) static unsigned run_roots(unsigned value)\n"
+            "{\n"
+            "    unsigned total = 0;\n");
+
+        for(int unit = 0; unit < graph.units; ++unit)
+        {
+            for(int function = 0;
+                function < graph.functions;
+                function += graph.depth)
+            {
+                source +=
+                    "    total += " + function_name(unit, function)
+                    + "(value);\n";
+            }
+        }
+
+        source +=
+            "    return total;\n"
+            "}\n"
+            "\n"
+            "static volatile unsigned sink;\n"
+            "\n"
+            "// Usage: callgraph VARIANT [WARMUP_ROUNDS [ROUNDS]], or\n"
+            "// callgraph --startup to exit straight away\n"
+            "int main(int argc, char* argv[])\n"
+            "{\n"
+            "    if(argc < 2 || !std::strcmp(argv[1], \"--startup\"))\n"
+            "    {\n"
+            "        return 0;\n"
+            "    }\n"
+            "\n"
+            "    int warmup = argc > 2 ? std::atoi(argv[2]) : 100;\n"
+            "    int rounds = argc > 3 ? std::atoi(argv[3]) : 1000;\n"
+            "\n"
+            "    auto start = std::chrono::steady_clock::now();\n"
+            "    for(int round = 0; round < warmup; ++round)\n"
+            "    {\n"
+            "        sink = run_roots(round);\n"
+            "    }\n"
+            "    auto steady = std::chrono::steady_clock::now();\n"
+            "    for(int round = 0; round < rounds; ++round)\n"
+            "    {\n"
+            "        sink = run_roots(round);\n"
+            "    }\n"
+            "    auto end = std::chrono::steady_clock::now();\n"
+            "\n"
+            "    using std::chrono::duration_cast;\n"
+            "    using std::chrono::milliseconds;\n"
+            "    using std::chrono::nanoseconds;\n"
+            "    std::cout\n"
+            "        << \"warmup_\" << argv[1] << \"_ms,\"\n"
+            "        << duration_cast<milliseconds>(steady - start).count()\n"
+            "        << \"\\n\"\n"
+            "        << \"steady_\" << argv[1] << \"_ns_per_call,\"\n"
+            "        << double(duration_cast<nanoseconds>(end - steady).count())\n"
+            "            / (double(rounds) * calls_per_round)\n"
+            "        << \"\\n\";\n"
+            "    return 0;\n"
+            "}\n";
+
+        return source;
+    }
+
+    std::string generate_targets(const shape& graph)
+    {
+        std::string targets("_ZL9run_rootsj\n");
+        for(int unit = 0; unit < graph.units; ++unit)
+        {
+            for(int function = 0; function < graph.functions; ++function)
+            {
+                targets += mangled_name(function_name(unit, function)) + "\n";
+            }
+        }
+        return targets;
+    }
+
+    std::string generate_makefile(const shape& graph, const char* root)
+    {
+        std::string makefile(
+            "DRTI_ROOT = " + std::string(root) + "\n"
+            "UNITS = main");
+        for(int unit = 0; unit < graph.units; ++unit)
+        {
+            makefile += " unit" + std::to_string(unit);
+        }
+        makefile +=
+            "\n"
+            "\n"
+            "include $(DRTI_ROOT)/tests/callgraph.mk\n";
+        return makefile;
+    }
+
+    bool parse_options(int argc, char* argv[], shape& graph)
+    {
+        const std::map<std::string, int*> options{
+            {"--units", &graph.units},
+            {"--functions", &graph.functions},
+            {"--depth", &graph.depth},
+            {"--fanout", &graph.fanout},
+            {"--polymorphism", &graph.polymorphism},
+            {"--padding", &graph.padding},
+            {"--seed", &graph.seed}};
+
+        for(int arg = 3; arg < argc; arg += 2)
+        {
+            auto found = options.find(argv[arg]);
+            if(found == options.end() || arg + 1 == argc)
+            {
+                std::cerr << "callgraph_gen: bad option " << argv[arg] << "\n";
+                return false;
+            }
+            *found->second = atoi(argv[arg + 1]);
+        }
+
+        if(graph.units < 1 || graph.depth < 1 || graph.fanout < 1
+           || graph.polymorphism < 1 || graph.padding < 0
+           || graph.functions < graph.depth)
+        {
+            std::cerr
+                << "callgraph_gen: need at least one unit, depth, fanout "
+                "and target, and at least depth functions per unit\n";
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    shape graph;
+    if(argc < 3 || !parse_options(argc, argv, graph))
+    {
+        std::cerr
+            << "Usage: callgraph_gen DIRECTORY DRTI_ROOT [OPTION VALUE]...\n";
+        return 2;
+    }
+
+    std::string directory(argv[1]);
+    mkdir(directory.c_str(), 0777);
+
+    std::minstd_rand random(graph.seed);
+
+    bool ok =
+        write_file(directory, "callgraph.hpp", generate_header(graph))
+        && write_file(directory, "main.cpp", generate_main(graph))
+        && write_file(
+            directory, "drti_test_targets.txt", generate_targets(graph))
+        && write_file(
+            directory, "Makefile", generate_makefile(graph, argv[2]));
+
+    for(int unit = 0; ok && unit < graph.units; ++unit)
+    {
+        std::string name("unit" + std::to_string(unit) + ".cpp");
+        ok = write_file(
+            directory, name.c_str(), generate_unit(graph, unit, random));
+    }
+
+    return ok ? 0 : 1;
+}
@@ -37,6 +37,7 @@ static std::vector<drti::treenode*> s_inspected;
 namespace drti
 {
     void inspect_treenode(treenode*);
+    void register_module(reflect*);
 }
 
 void drti::inspect_treenode(treenode* node)
@@ -46,6 +47,11 @@ void drti::inspect_treenode(treenode* node)
     s_inspected.push_back(node);
 }
 
+void drti::register_module(reflect*)
+{
+    // Only the runtime proper needs to know the loaded classes
+}
+
 //! Call a leaf function for the call tree
 __attribute__((noinline)) void call_leaf()
 {
@@ -65,7 +71,7 @@ __attribute__((noinline)) void test1()
     assert(s_inspected.front()->parent == nullptr);
     // Check the caller and callee names
     assert(std::string("_Z9call_leafv") == s_inspected.front()->location.landing.function_name);
-    assert(std::string("_Z12test_target1v") == s_inspected.front()->landing->function_name);
+    assert(std::string("_Z12test_target1v") == atomic_load(&s_inspected.front()->landing)->function_name);
 }
 
 int main(int argc, char *argv[])
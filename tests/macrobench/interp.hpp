@@ -0,0 +1,71 @@
+// -*- mode:c++ -*-
+//
+// Header file interp.hpp
+//
+// A small bytecode interpreter whose instruction handlers are called
+// through a table of function pointers
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef interp_rmg_20261018_included
+#define interp_rmg_20261018_included
+
+#include <cstdint>
+
+namespace macrobench
+{
+    struct machine
+    {
+        int64_t accumulator = 0;
+        int64_t registers[8] = {};
+        int pc = 0;
+        bool halted = false;
+    };
+
+    enum opcode : uint8_t
+    {
+        op_load,
+        op_store,
+        op_add,
+        op_multiply,
+        op_xor,
+        op_decrement,
+        op_jump_nonzero,
+        op_halt,
+        opcode_count
+    };
+
+    struct instruction
+    {
+        opcode code;
+        //! A register number, an immediate value or a jump target,
+        //! depending on the code
+        int8_t operand;
+    };
+
+    using handler = void (*)(machine&, int operand);
+
+    //! Indexed by opcode, defined with the handlers in interp_ops.cpp
+    extern const handler dispatch[opcode_count];
+}
+
+#endif // interp_rmg_20261018_included
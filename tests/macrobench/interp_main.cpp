@@ -0,0 +1,83 @@
+// -*- mode:c++ -*-
+//
+// Module interp_main.cpp
+//
+// Interpreter dispatch benchmark. Every instruction goes through one
+// indirect call site in step(), which sees all the handlers
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "interp.hpp"
+#include "macrobench.hpp"
+
+namespace
+{
+    // Mixes register 1 with some arithmetic, once per loop
+    const macrobench::instruction program[] = {
+        {macrobench::op_load, 1},
+        {macrobench::op_multiply, 5},
+        {macrobench::op_add, 3},
+        {macrobench::op_xor, 0x55},
+        {macrobench::op_store, 1},
+        {macrobench::op_decrement, 0},
+        {macrobench::op_jump_nonzero, 0},
+        {macrobench::op_halt, 0}
+    };
+
+    //! Instructions executed per loop iteration
+    constexpr int loop_length = 7;
+}
+
+NOT_INLINED static void step(
+    macrobench::machine& state, const macrobench::instruction& next)
+{
+    macrobench::dispatch[next.code](state, next.operand);
+}
+
+NOT_INLINED static int64_t interpret(
+    const macrobench::instruction* code, int64_t loops)
+{
+    macrobench::machine state;
+    state.registers[0] = loops;
+
+    while(!state.halted)
+    {
+        step(state, code[state.pc++]);
+    }
+
+    return state.registers[1];
+}
+
+int main(int argc, char* argv[])
+{
+    macrobench::arguments args;
+    if(!macrobench::parse(argc, argv, 50000000, args))
+    {
+        return 2;
+    }
+
+    int64_t loops = args.operations / loop_length;
+    return macrobench::measure(
+        "interp", args, loops * loop_length, [loops]() {
+            return interpret(program, loops);
+        });
+}
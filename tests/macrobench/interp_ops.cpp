@@ -0,0 +1,87 @@
+// -*- mode:c++ -*-
+//
+// Module interp_ops.cpp
+//
+// The instruction handlers for interp_main.cpp, in their own module so
+// that only link-time optimization or DRTI can inline them
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "interp.hpp"
+
+namespace macrobench
+{
+    void load(machine& state, int reg)
+    {
+        state.accumulator = state.registers[reg];
+    }
+
+    void store(machine& state, int reg)
+    {
+        state.registers[reg] = state.accumulator;
+    }
+
+    void add(machine& state, int value)
+    {
+        state.accumulator += value;
+    }
+
+    void multiply(machine& state, int value)
+    {
+        state.accumulator *= value;
+    }
+
+    void exclusive_or(machine& state, int value)
+    {
+        state.accumulator ^= value;
+    }
+
+    void decrement(machine& state, int reg)
+    {
+        --state.registers[reg];
+    }
+
+    //! Tests register 0, the loop counter by convention
+    void jump_nonzero(machine& state, int target)
+    {
+        if(state.registers[0])
+        {
+            state.pc = target;
+        }
+    }
+
+    void halt(machine& state, int)
+    {
+        state.halted = true;
+    }
+}
+
+const macrobench::handler macrobench::dispatch[opcode_count] = {
+    load,
+    store,
+    add,
+    multiply,
+    exclusive_or,
+    decrement,
+    jump_nonzero,
+    halt
+};
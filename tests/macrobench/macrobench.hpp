@@ -0,0 +1,133 @@
+// -*- mode:c++ -*-
+//
+// Header file macrobench.hpp
+//
+// Timing and reporting shared by the macro-benchmark programs, which
+// are built plain, with link-time optimization and with DRTI (see
+// the Makefile)
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef macrobench_rmg_20261018_included
+#define macrobench_rmg_20261018_included
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+// As in raw_tests.cpp, DRTI needs chains of decorated calls that
+// ahead-of-time compilation has not inlined
+#define NOT_INLINED __attribute__((noinline))
+
+namespace macrobench
+{
+    //! Command line of every benchmark program:
+    //!
+    //!   PROGRAM VARIANT RESULTS_FILE [OPERATIONS]
+    //!
+    //! where an operation is an interpreted instruction, a virtual
+    //! call or a pipeline stage, and the count is approximate
+    struct arguments
+    {
+        const char* variant = nullptr;
+        const char* results = nullptr;
+        int64_t operations = 0;
+    };
+
+    inline bool parse(
+        int argc, char* argv[], int64_t default_operations, arguments& args)
+    {
+        if(argc < 3 || argc > 4)
+        {
+            std::cerr
+                << "Usage: " << argv[0]
+                << " VARIANT RESULTS_FILE [OPERATIONS]\n";
+            return false;
+        }
+
+        args.variant = argv[1];
+        args.results = argv[2];
+        args.operations = argc > 3 ? atoll(argv[3]) : default_operations;
+        return true;
+    }
+
+    //! Times a warm-up run, which includes any runtime compilation,
+    //! and then a measured run, each doing the given number of
+    //! operations. Appends benchmark,variant,operations,warmup_ms,
+    //! ns_per_operation,checksum to the results file
+    template<typename Run>
+    int measure(
+        const char* benchmark,
+        const arguments& args,
+        int64_t operations,
+        Run run)
+    {
+        using clock = std::chrono::steady_clock;
+
+        auto start = clock::now();
+        int64_t warmup_checksum = run();
+        auto steady = clock::now();
+        int64_t checksum = run();
+        auto end = clock::now();
+
+        if(checksum != warmup_checksum)
+        {
+            std::cerr
+                << benchmark << " " << args.variant
+                << ": checksum changed from " << warmup_checksum
+                << " to " << checksum << "\n";
+            return 1;
+        }
+
+        auto warmup_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            steady - start).count();
+        double per_operation =
+            double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       end - steady).count())
+            / operations;
+
+        std::ofstream results(args.results, std::ios::app);
+        if(results.tellp() == 0)
+        {
+            results
+                << "benchmark,variant,operations,warmup_ms,"
+                "ns_per_operation,checksum\n";
+        }
+        results
+            << benchmark << ","
+            << args.variant << ","
+            << operations << ","
+            << warmup_ms << ","
+            << per_operation << ","
+            << checksum << "\n";
+
+        std::cout
+            << benchmark << " " << args.variant << " "
+            << per_operation << " ns/operation\n";
+
+        return results ? 0 : 1;
+    }
+}
+
+#endif // macrobench_rmg_20261018_included
@@ -0,0 +1,63 @@
+// -*- mode:c++ -*-
+//
+// Header file pipeline.hpp
+//
+// Stream processing stages behind an abstract interface. Each
+// implementation lives in its own shared library, which link-time
+// optimization can't see into but DRTI can
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef pipeline_rmg_20261018_included
+#define pipeline_rmg_20261018_included
+
+#include <cstdint>
+#include <memory>
+
+namespace macrobench
+{
+    struct stage
+    {
+        virtual ~stage() = default;
+        virtual int64_t process(int64_t value) = 0;
+    };
+
+    //! In libpipeline_scale.so
+    std::unique_ptr<stage> make_scale(int64_t numerator, int64_t denominator);
+    //! In libpipeline_clamp.so
+    std::unique_ptr<stage> make_clamp(int64_t low, int64_t high);
+    //! In libpipeline_checksum.so. Passes values through unchanged
+    std::unique_ptr<stage> make_checksum();
+
+    //! Names the type of the virtual calls for drti_test_targets.txt,
+    //! like drti_test::type_matched_function
+    inline int64_t type_matched_function(stage*, int64_t);
+}
+
+// Never called but needed by name during the DRTI decoration pass
+__attribute__((used)) inline int64_t macrobench::type_matched_function(
+    stage*, int64_t)
+{
+    return 0;
+}
+
+#endif // pipeline_rmg_20261018_included
@@ -0,0 +1,47 @@
+// -*- mode:c++ -*-
+//
+// Module pipeline_checksum.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "pipeline.hpp"
+
+namespace macrobench
+{
+    struct checksum : stage
+    {
+        int64_t process(int64_t value) override;
+
+        uint64_t m_total = 0;
+    };
+}
+
+int64_t macrobench::checksum::process(int64_t value)
+{
+    m_total = (m_total << 5) + m_total + uint64_t(value);
+    return value;
+}
+
+std::unique_ptr<macrobench::stage> macrobench::make_checksum()
+{
+    return std::make_unique<checksum>();
+}
@@ -0,0 +1,54 @@
+// -*- mode:c++ -*-
+//
+// Module pipeline_clamp.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "pipeline.hpp"
+
+namespace macrobench
+{
+    struct clamp : stage
+    {
+        clamp(int64_t low, int64_t high) :
+            m_low(low),
+            m_high(high)
+        {
+        }
+
+        int64_t process(int64_t value) override;
+
+        const int64_t m_low;
+        const int64_t m_high;
+    };
+}
+
+int64_t macrobench::clamp::process(int64_t value)
+{
+    return value < m_low ? m_low : value > m_high ? m_high : value;
+}
+
+std::unique_ptr<macrobench::stage> macrobench::make_clamp(
+    int64_t low, int64_t high)
+{
+    return std::make_unique<clamp>(low, high);
+}
@@ -0,0 +1,74 @@
+// -*- mode:c++ -*-
+//
+// Module pipeline_main.cpp
+//
+// Pipeline benchmark, pushing a stream of values through stages from
+// separate shared libraries via one virtual call site
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "macrobench.hpp"
+#include "pipeline.hpp"
+
+#include <vector>
+
+NOT_INLINED static int64_t run_stage(macrobench::stage& next, int64_t value)
+{
+    return next.process(value);
+}
+
+NOT_INLINED static int64_t run_pipeline(
+    const std::vector<macrobench::stage*>& stages, int64_t count)
+{
+    int64_t total = 0;
+    for(int64_t item = 0; item < count; ++item)
+    {
+        int64_t value = item;
+        for(macrobench::stage* next: stages)
+        {
+            value = run_stage(*next, value);
+        }
+        total += value;
+    }
+    return total;
+}
+
+int main(int argc, char* argv[])
+{
+    macrobench::arguments args;
+    if(!macrobench::parse(argc, argv, 50000000, args))
+    {
+        return 2;
+    }
+
+    auto scale(macrobench::make_scale(7, 3));
+    auto clamp(macrobench::make_clamp(100, 1000000));
+    auto checksum(macrobench::make_checksum());
+    const std::vector<macrobench::stage*> stages{
+        scale.get(), clamp.get(), checksum.get()};
+
+    int64_t items = args.operations / int64_t(stages.size());
+    return macrobench::measure(
+        "pipeline", args, items * int64_t(stages.size()), [&]() {
+            return run_pipeline(stages, items);
+        });
+}
@@ -0,0 +1,54 @@
+// -*- mode:c++ -*-
+//
+// Module pipeline_scale.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "pipeline.hpp"
+
+namespace macrobench
+{
+    struct scale : stage
+    {
+        scale(int64_t numerator, int64_t denominator) :
+            m_numerator(numerator),
+            m_denominator(denominator)
+        {
+        }
+
+        int64_t process(int64_t value) override;
+
+        const int64_t m_numerator;
+        const int64_t m_denominator;
+    };
+}
+
+int64_t macrobench::scale::process(int64_t value)
+{
+    return value * m_numerator / m_denominator;
+}
+
+std::unique_ptr<macrobench::stage> macrobench::make_scale(
+    int64_t numerator, int64_t denominator)
+{
+    return std::make_unique<scale>(numerator, denominator);
+}
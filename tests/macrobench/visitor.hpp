@@ -0,0 +1,120 @@
+// -*- mode:c++ -*-
+//
+// Header file visitor.hpp
+//
+// An expression tree evaluated by a visitor, so that every node costs
+// a virtual accept call and a virtual visit call
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#ifndef visitor_rmg_20261018_included
+#define visitor_rmg_20261018_included
+
+#include <cstdint>
+#include <memory>
+
+namespace macrobench
+{
+    struct visitor;
+
+    struct expression
+    {
+        virtual ~expression() = default;
+        virtual int64_t accept(visitor&) const = 0;
+    };
+
+    struct number : expression
+    {
+        explicit number(int64_t);
+        int64_t accept(visitor&) const override;
+
+        int64_t value;
+    };
+
+    struct binary : expression
+    {
+        binary(std::unique_ptr<expression>, std::unique_ptr<expression>);
+
+        std::unique_ptr<expression> left;
+        std::unique_ptr<expression> right;
+    };
+
+    struct sum : binary
+    {
+        using binary::binary;
+        int64_t accept(visitor&) const override;
+    };
+
+    struct product : binary
+    {
+        using binary::binary;
+        int64_t accept(visitor&) const override;
+    };
+
+    struct visitor
+    {
+        virtual ~visitor() = default;
+        virtual int64_t visit(const number&) = 0;
+        virtual int64_t visit(const sum&) = 0;
+        virtual int64_t visit(const product&) = 0;
+    };
+
+    //! A balanced tree with 2^depth leaves, in visitor_tree.cpp
+    std::unique_ptr<expression> build_tree(int depth, int64_t seed);
+
+    //! Computes the value of the tree, in visitor_eval.cpp
+    std::unique_ptr<visitor> make_evaluator();
+
+    //! These name the types of the virtual calls for
+    //! drti_test_targets.txt, like drti_test::type_matched_function
+    inline int64_t type_matched_function(const expression*, visitor&);
+    inline int64_t type_matched_function(visitor*, const number&);
+    inline int64_t type_matched_function(visitor*, const sum&);
+    inline int64_t type_matched_function(visitor*, const product&);
+}
+
+// Never called but needed by name during the DRTI decoration pass
+__attribute__((used)) inline int64_t macrobench::type_matched_function(
+    const expression*, visitor&)
+{
+    return 0;
+}
+
+__attribute__((used)) inline int64_t macrobench::type_matched_function(
+    visitor*, const number&)
+{
+    return 0;
+}
+
+__attribute__((used)) inline int64_t macrobench::type_matched_function(
+    visitor*, const sum&)
+{
+    return 0;
+}
+
+__attribute__((used)) inline int64_t macrobench::type_matched_function(
+    visitor*, const product&)
+{
+    return 0;
+}
+
+#endif // visitor_rmg_20261018_included
@@ -0,0 +1,60 @@
+// -*- mode:c++ -*-
+//
+// Module visitor_eval.cpp
+//
+// The evaluating visitor for visitor_main.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "visitor.hpp"
+
+namespace macrobench
+{
+    struct evaluator : visitor
+    {
+        int64_t visit(const number&) override;
+        int64_t visit(const sum&) override;
+        int64_t visit(const product&) override;
+    };
+}
+
+int64_t macrobench::evaluator::visit(const number& leaf)
+{
+    return leaf.value;
+}
+
+int64_t macrobench::evaluator::visit(const sum& node)
+{
+    return node.left->accept(*this) + node.right->accept(*this);
+}
+
+int64_t macrobench::evaluator::visit(const product& node)
+{
+    // Keep the values bounded without losing the dependency on both
+    // sides
+    return (node.left->accept(*this) * node.right->accept(*this)) % 1000003;
+}
+
+std::unique_ptr<macrobench::visitor> macrobench::make_evaluator()
+{
+    return std::make_unique<evaluator>();
+}
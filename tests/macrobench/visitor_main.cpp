@@ -0,0 +1,74 @@
+// -*- mode:c++ -*-
+//
+// Module visitor_main.cpp
+//
+// Visitor benchmark, evaluating the same expression tree repeatedly
+// through virtual accept and visit calls
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "macrobench.hpp"
+#include "visitor.hpp"
+
+namespace
+{
+    constexpr int tree_depth = 10;
+    //! Virtual calls per evaluation: an accept and a visit per node
+    constexpr int64_t calls_per_tree = 2 * ((int64_t(2) << tree_depth) - 1);
+}
+
+NOT_INLINED static int64_t evaluate(
+    const macrobench::expression& tree, macrobench::visitor& visiting)
+{
+    return tree.accept(visiting);
+}
+
+NOT_INLINED static int64_t evaluate_repeatedly(
+    const macrobench::expression& tree,
+    macrobench::visitor& visiting,
+    int64_t count)
+{
+    int64_t total = 0;
+    for(int64_t pass = 0; pass < count; ++pass)
+    {
+        total += evaluate(tree, visiting);
+    }
+    return total;
+}
+
+int main(int argc, char* argv[])
+{
+    macrobench::arguments args;
+    if(!macrobench::parse(argc, argv, 50000000, args))
+    {
+        return 2;
+    }
+
+    auto tree(macrobench::build_tree(tree_depth, 1));
+    auto evaluator(macrobench::make_evaluator());
+
+    int64_t passes = args.operations / calls_per_tree;
+    return macrobench::measure(
+        "visitor", args, passes * calls_per_tree, [&]() {
+            return evaluate_repeatedly(*tree, *evaluator, passes);
+        });
+}
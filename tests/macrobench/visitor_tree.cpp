@@ -0,0 +1,75 @@
+// -*- mode:c++ -*-
+//
+// Module visitor_tree.cpp
+//
+// The expression classes for visitor_main.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "visitor.hpp"
+
+macrobench::number::number(int64_t initial) :
+    value(initial)
+{
+}
+
+int64_t macrobench::number::accept(visitor& visiting) const
+{
+    return visiting.visit(*this);
+}
+
+macrobench::binary::binary(
+    std::unique_ptr<expression> lhs, std::unique_ptr<expression> rhs) :
+
+    left(std::move(lhs)),
+    right(std::move(rhs))
+{
+}
+
+int64_t macrobench::sum::accept(visitor& visiting) const
+{
+    return visiting.visit(*this);
+}
+
+int64_t macrobench::product::accept(visitor& visiting) const
+{
+    return visiting.visit(*this);
+}
+
+std::unique_ptr<macrobench::expression> macrobench::build_tree(
+    int depth, int64_t seed)
+{
+    if(depth == 0)
+    {
+        return std::make_unique<number>(seed % 7 + 1);
+    }
+
+    auto left(build_tree(depth - 1, seed * 3 + 1));
+    auto right(build_tree(depth - 1, seed * 5 + 2));
+
+    // Mostly sums, so the values stay small
+    if(seed % 4 == 0)
+    {
+        return std::make_unique<product>(std::move(left), std::move(right));
+    }
+    return std::make_unique<sum>(std::move(left), std::move(right));
+}
@@ -0,0 +1,219 @@
+// -*- mode:c++ -*-
+//
+// Module microbench.cpp
+//
+// Measures the cost of calls through DRTI. The same source is built
+// three ways (see the bench target in the Makefile):
+//
+//   plain      no decoration, as the program would be without DRTI
+//   stub       decorated but never recompiled (see bench_stub.cpp)
+//   drti       decorated and recompiled by the runtime library
+//
+// Usage:
+//
+//   microbench-VARIANT VARIANT RESULTS_FILE [ITERATIONS [MAX_THREADS]]
+//
+// Each run appends lines of comma-separated values to RESULTS_FILE,
+// one per workload and thread count, and bench_summary.awk combines
+// the three variants
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "bench_targets.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// As in raw_tests.cpp, we need a chain of at least two decorated and
+// not inlined calls for DRTI to inline anything at runtime
+#define NOT_INLINED __attribute__((noinline))
+
+// The callers, which DRTI recompiles with the leaf inlined
+
+NOT_INLINED static int call_direct(int value)
+{
+    return drti_bench::direct_leaf(value);
+}
+
+NOT_INLINED static int call_pointer(drti_bench::leaf_function leaf, int value)
+{
+    return leaf(value);
+}
+
+NOT_INLINED static int call_virtual(const drti_bench::shape& shape, int value)
+{
+    return shape.scale(value);
+}
+
+// The loops, whose call sites DRTI retargets to the recompiled callers
+
+NOT_INLINED static int run_direct(int iterations)
+{
+    int total = 0;
+    for(int count = 0; count < iterations; ++count)
+    {
+        total += call_direct(count);
+    }
+    return total;
+}
+
+NOT_INLINED static int run_pointer(int iterations)
+{
+    drti_bench::leaf_function leaf = drti_bench::pointer_leaf();
+    int total = 0;
+    for(int count = 0; count < iterations; ++count)
+    {
+        total += call_pointer(leaf, count);
+    }
+    return total;
+}
+
+NOT_INLINED static int run_virtual(int iterations)
+{
+    const drti_bench::shape& shape(drti_bench::shape::instance());
+    int total = 0;
+    for(int count = 0; count < iterations; ++count)
+    {
+        total += call_virtual(shape, count);
+    }
+    return total;
+}
+
+namespace
+{
+    struct workload
+    {
+        const char* name;
+        int (*run)(int iterations);
+    };
+
+    const workload workloads[] = {
+        {"direct", run_direct},
+        {"pointer", run_pointer},
+        {"virtual", run_virtual}
+    };
+
+    using bench_clock = std::chrono::steady_clock;
+
+    int64_t nanoseconds_since(bench_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            bench_clock::now() - start).count();
+    }
+
+    //! Stops the compiler discarding results
+    volatile int sink;
+
+    //! Calls the workload a few times and returns the slowest call.
+    //! With the runtime library the first calls include compiling, so
+    //! this is the compile latency
+    int64_t warm_up(const workload& work)
+    {
+        int64_t slowest = 0;
+        for(int count = 0; count < 1000; ++count)
+        {
+            auto start = bench_clock::now();
+            sink = work.run(1);
+            slowest = std::max(slowest, nanoseconds_since(start));
+        }
+        return slowest;
+    }
+
+    //! Runs the workload on several threads at once and returns the
+    //! wall clock time per call on each thread
+    double time_calls(const workload& work, int iterations, int threads)
+    {
+        std::vector<std::thread> running;
+        auto start = bench_clock::now();
+
+        for(int thread = 0; thread < threads; ++thread)
+        {
+            running.emplace_back([&work, iterations]() {
+                sink = work.run(iterations);
+            });
+        }
+        for(std::thread& thread: running)
+        {
+            thread.join();
+        }
+
+        return double(nanoseconds_since(start)) / iterations;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3 || argc > 5)
+    {
+        std::cerr
+            << "Usage: " << argv[0]
+            << " VARIANT RESULTS_FILE [ITERATIONS [MAX_THREADS]]\n";
+        return 2;
+    }
+
+    const char* variant = argv[1];
+    int iterations = argc > 3 ? atoi(argv[3]) : 10000000;
+    int max_threads = argc > 4
+        ? atoi(argv[4])
+        : int(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::ofstream results(argv[2], std::ios::app);
+    if(!results)
+    {
+        std::cerr << argv[0] << ": unable to open " << argv[2] << "\n";
+        return 1;
+    }
+
+    if(results.tellp() == 0)
+    {
+        results << "variant,workload,threads,ns_per_call,warmup_max_ns\n";
+    }
+
+    for(const workload& work: workloads)
+    {
+        int64_t warmup = warm_up(work);
+
+        for(int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double per_call = time_calls(work, iterations, threads);
+
+            results
+                << variant << ","
+                << work.name << ","
+                << threads << ","
+                << per_call << ","
+                << warmup << "\n";
+
+            std::cout
+                << variant << " " << work.name
+                << " threads " << threads
+                << " " << per_call << " ns/call\n";
+        }
+    }
+
+    return 0;
+}
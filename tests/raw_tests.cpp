@@ -29,10 +29,17 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "test_support.hpp"
 #include "test_class.hpp"
 
+#include <drti/runtime.hpp>
+
 using test_function_type1 = const void* (*)();
 
 enum class result_type { pass, fail, known_bug };
@@ -224,6 +231,618 @@ NOT_INLINED static result_type test5()
     return result_type::fail;
 }
 
+// Invocation via two function pointers from the same function
+NOT_INLINED static bool invoke_pair(
+    test_function_type1 target1,
+    test_function_type1 target2,
+    const void*& last_result1,
+    const void*& last_result2)
+{
+    const void* next_result1 = target1();
+    const void* next_result2 = target2();
+
+    if(!last_result1)
+    {
+        last_result1 = next_result1;
+        last_result2 = next_result2;
+    }
+
+    return next_result1 != last_result1 && next_result2 != last_result2;
+}
+
+NOT_INLINED static result_type test6()
+{
+    // Like test2 but with two different call sites that should both
+    // get inlined into the same recompiled function
+    const void* last_result1 = nullptr;
+    const void* last_result2 = nullptr;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke_pair(test_target1, test_target2, last_result1, last_result2))
+        {
+            // Success!
+            std::cout << "test6 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test6 failed: return values didn't both change\n";
+    return result_type::fail;
+}
+
+// Invocation of several targets from a single call site
+NOT_INLINED static bool invoke_each(
+    const test_function_type1* targets,
+    const void** last_results,
+    int target_count)
+{
+    bool all_changed = true;
+
+    for(int index = 0; index < target_count; ++index)
+    {
+        const void* next_result = targets[index]();
+
+        if(!last_results[index])
+        {
+            last_results[index] = next_result;
+        }
+
+        all_changed = all_changed && (next_result != last_results[index]);
+    }
+
+    return all_changed;
+}
+
+NOT_INLINED static result_type test7(int external_data)
+{
+    // Both targets get called from the same call site in the first
+    // invocation, so the call site should be recompiled with a guard
+    // and inlined call for each of them
+    const test_function_type1 targets[2] = { test_target1, test_target2 };
+    const void* last_results[2] = { nullptr, nullptr };
+    // Avoids unrolling at compile time, which would split the call site
+    const int target_count = external_data > 0 ? 2 : 1;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke_each(targets, last_results, target_count))
+        {
+            // Success!
+            std::cout << "test7 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test7 failed: return values didn't all change\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static bool invoke_until_changed(test_function_type1 target)
+{
+    const void* last_result = nullptr;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke(target, last_result))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+NOT_INLINED static result_type test8(int external_data)
+{
+    // The second target only shows up after invoke has been
+    // recompiled for the first one, so its calls go via the slow path
+    // of the recompiled code. That path has to keep building the call
+    // tree for the second target to get inlined as well
+    const test_function_type1 targets[2] = { test_target1, test_target2 };
+    // Avoids unrolling at compile time, which would split the call site
+    const int target_count = external_data > 0 ? 2 : 1;
+
+    for(int index = 0; index < target_count; ++index)
+    {
+        if(!invoke_until_changed(targets[index]))
+        {
+            std::cout
+                << "test8 failed: return value never changed for target "
+                << index << "\n";
+            return result_type::fail;
+        }
+    }
+    std::cout << "test8 passed\n";
+    return result_type::pass;
+}
+
+using test_function_type5 = const void* (*)(int, int&, const int*&);
+
+NOT_INLINED static bool invoke_constants(
+    test_function_type5 target,
+    int index,
+    const void*& last_result,
+    int& value,
+    const int*& address)
+{
+    const void* next_result = target(index, value, address);
+
+    if(!last_result)
+    {
+        last_result = next_result;
+    }
+
+    return next_result != last_result;
+}
+
+// test_target5's table, which the Makefile exports from the object
+// file although the bitcode only sees a local constant
+extern "C" const int drti_test_folded_table[4];
+
+//! Stores to the table in place, despite it being read-only
+NOT_INLINED static void overwrite_folded_table(const int (&values)[4])
+{
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t first =
+        reinterpret_cast<uintptr_t>(drti_test_folded_table);
+    const uintptr_t start = first & ~(page - 1);
+    const size_t length = first + sizeof(values) - start;
+    void* pages = reinterpret_cast<void*>(start);
+
+    // Keeps PROT_EXEC in case the linker put the table next to code
+    if(mprotect(pages, length, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    {
+        std::cout << "overwrite_folded_table: mprotect failed\n";
+        std::abort();
+    }
+
+    volatile int* table = const_cast<volatile int*>(drti_test_folded_table);
+    for(int index = 0; index < 4; ++index)
+    {
+        table[index] = values[index];
+    }
+
+    mprotect(pages, length, PROT_READ | PROT_EXEC);
+}
+
+NOT_INLINED static result_type test9(int external_data)
+{
+    // Recompiled code gets its own copy of constant data that is only
+    // loaded from, but must keep using the original of a constant
+    // whose address escapes
+    static const int expected[] = { 2, 3, 5, 7 };
+    const void* last_result = nullptr;
+    const int* original_address = nullptr;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        const int index = (count + external_data) % 4;
+        int value = 0;
+        const int* address = nullptr;
+
+        const bool changed = invoke_constants(
+            test_target5, index, last_result, value, address);
+
+        if(!original_address)
+        {
+            original_address = address;
+        }
+
+        if(value != expected[index])
+        {
+            std::cout << "test9 failed: wrong value from constant table\n";
+            return result_type::fail;
+        }
+
+        if(address != original_address || *address != 11)
+        {
+            std::cout << "test9 failed: constant address changed\n";
+            return result_type::fail;
+        }
+
+        if(changed)
+        {
+            // Breaks the original table behind the runtime's back, so
+            // only code with its own copy still sees the primes
+            static const int broken[] = { 0, 0, 0, 0 };
+            overwrite_folded_table(broken);
+            invoke_constants(test_target5, index, last_result, value, address);
+            overwrite_folded_table(expected);
+
+            if(value != expected[index])
+            {
+                std::cout << "test9 failed: constant table not copied\n";
+                return result_type::fail;
+            }
+
+            // Success!
+            std::cout << "test9 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test9 failed: return value never changed\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static const void* call_through(test_function_type1 callback)
+{
+    return callback();
+}
+
+using test_function_type6 = const void* (*)(test_function_type1);
+
+NOT_INLINED static bool invoke_with(
+    test_function_type6 target,
+    test_function_type1 callback,
+    const void*& last_result)
+{
+    const void* next_result = target(callback);
+
+    if(!last_result)
+    {
+        last_result = next_result;
+    }
+
+    return next_result != last_result;
+}
+
+NOT_INLINED static result_type test10()
+{
+    // call_through always gets the same callback at first, so once
+    // it has DRTI_MIN_ARG_SAMPLES calls (set low by the Makefile) it
+    // gets recompiled with the callback as a constant. Passing a
+    // different callback afterwards has to fail the guard and call
+    // the new one
+    const int64_t specialised = drti::arguments_specialised();
+    const void* last_result = nullptr;
+    bool changed = false;
+
+    for(int count = 0; count < 1000 && !changed; ++count)
+    {
+        changed = invoke_with(call_through, test_target1, last_result);
+    }
+
+    if(!changed)
+    {
+        std::cout << "test10 failed: return value never changed\n";
+        return result_type::fail;
+    }
+
+    if(drti::arguments_specialised() == specialised)
+    {
+        std::cout << "test10 failed: callback not specialised\n";
+        return result_type::fail;
+    }
+
+    // Makes sure the counter exists
+    test_target2();
+    const unsigned before = drti_test::get_counter("test_target2");
+
+    const void* ignored = nullptr;
+    invoke_with(call_through, test_target2, ignored);
+
+    if(drti_test::get_counter("test_target2") != before + 1)
+    {
+        std::cout << "test10 failed: specialised callback was called\n";
+        return result_type::fail;
+    }
+
+    std::cout << "test10 passed\n";
+    return result_type::pass;
+}
+
+NOT_INLINED static result_type test11()
+{
+    // Like test5 but the implementation has interface as a secondary
+    // base class, so the vtable holds a thunk which adjusts the this
+    // pointer. The inlined call has to make the same adjustment
+    std::unique_ptr<drti_test::interface> object(
+        drti_test::interface::create_secondary());
+
+    const void* last_result = nullptr;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke_virtual(*object, last_result))
+        {
+            std::cout << "test11 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test11 failed: return value never changed\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static bool invoke_sole(
+    drti_test::sole_interface& object, const void*& last_result)
+{
+    const void* next_result = object.sole_function();
+
+    if(!last_result)
+    {
+        last_result = next_result;
+    }
+
+    return next_result != last_result;
+}
+
+static bool whole_program()
+{
+    const char* setting = std::getenv("DRTI_WHOLE_PROGRAM");
+    return setting && std::atoi(setting);
+}
+
+NOT_INLINED static result_type test12()
+{
+    // Like test5 but only one class implements the interface, so with
+    // DRTI_WHOLE_PROGRAM set the call goes direct without a guard
+    std::unique_ptr<drti_test::sole_interface> object(
+        drti_test::sole_interface::create());
+
+    const int64_t guards = drti::guards_installed();
+    const int64_t devirtualised = drti::calls_devirtualised();
+    const void* last_result = nullptr;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke_sole(*object, last_result))
+        {
+            const int64_t added_guards = drti::guards_installed() - guards;
+            const int64_t added_direct =
+                drti::calls_devirtualised() - devirtualised;
+
+            if(whole_program() ? added_guards || added_direct != 1
+               : !added_guards || added_direct)
+            {
+                std::cout
+                    << "test12 failed: installed " << added_guards
+                    << " guard(s) and " << added_direct
+                    << " devirtualised call(s)\n";
+                return result_type::fail;
+            }
+            std::cout << "test12 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test12 failed: return value never changed\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static bool invoke_algorithm(
+    drti_test::algorithm& object, const void*& last_result)
+{
+    const void* next_result = object.run();
+
+    if(!last_result)
+    {
+        last_result = next_result;
+    }
+
+    return next_result != last_result;
+}
+
+NOT_INLINED static result_type test13()
+{
+    // The inlined run() gets customised for the receiver's class, so
+    // its virtual call on this goes direct and step() gets inlined as
+    // well. Until then run() reports the address in the original
+    // step(), and nothing else inlines step(). With DRTI_WHOLE_PROGRAM
+    // the call to run() goes direct instead, without the vtable guard
+    // that customisation needs
+    std::unique_ptr<drti_test::algorithm> object(
+        drti_test::algorithm::create());
+
+    const void* original_step = object->step();
+    const int64_t devirtualised = drti::calls_devirtualised();
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        const void* last_result = original_step;
+        if(invoke_algorithm(*object, last_result)
+           || (whole_program()
+               && drti::calls_devirtualised() != devirtualised))
+        {
+            std::cout << "test13 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test13 failed: step() never inlined into run()\n";
+    return result_type::fail;
+}
+
+static int frozen_setting = 3;
+
+NOT_INLINED static const void* frozen_target(int& observed)
+{
+    observed = frozen_setting;
+    return drti_test::instruction_pointer();
+}
+
+NOT_INLINED static bool invoke_frozen(const void*& last_result, int& observed)
+{
+    const void* next_result = frozen_target(observed);
+
+    if(!last_result)
+    {
+        last_result = next_result;
+    }
+
+    return next_result != last_result;
+}
+
+NOT_INLINED static result_type test14()
+{
+    // The recompiled code can fold frozen_setting as a constant, and
+    // must stop doing so once it is thawed
+    drti::freeze(frozen_setting);
+
+    const void* last_result = nullptr;
+    int observed = 0;
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        if(invoke_frozen(last_result, observed))
+        {
+            // Breaks the freeze behind the runtime's back, so only
+            // code that folded the value still sees 3
+            *static_cast<volatile int*>(&frozen_setting) = 5;
+            invoke_frozen(last_result, observed);
+
+            if(observed != 3)
+            {
+                std::cout << "test14 failed: frozen value not folded\n";
+                return result_type::fail;
+            }
+
+            drti::thaw(frozen_setting);
+            frozen_setting = 4;
+            invoke_frozen(last_result, observed);
+
+            if(observed != 4)
+            {
+                std::cout << "test14 failed: stale value after thaw\n";
+                return result_type::fail;
+            }
+            std::cout << "test14 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test14 failed: return value never changed\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static const void* invoke_changing(drti_test::interface& object)
+{
+    return object.virtual_function();
+}
+
+NOT_INLINED static result_type test15()
+{
+    // The derived class inherits impl's virtual_function, so once
+    // invoke_changing is recompiled for impl the vtable guard misses
+    // without the call landing anywhere new. Only deoptimizing and
+    // recompiling can inline the call again, and the hits from
+    // before the change mustn't hold that up since each check only
+    // looks at the calls since the previous one
+    std::unique_ptr<drti_test::interface> object(
+        drti_test::interface::create());
+    std::unique_ptr<drti_test::interface> derived(
+        drti_test::interface::create_derived());
+
+    const void* original = invoke_changing(*object);
+    const void* inlined = nullptr;
+
+    for(int count = 0; count < 1000 && !inlined; ++count)
+    {
+        const void* result = invoke_changing(*object);
+        if(result != original)
+        {
+            inlined = result;
+        }
+    }
+
+    if(!inlined)
+    {
+        std::cout << "test15 failed: return value never changed\n";
+        return result_type::fail;
+    }
+
+    for(int count = 0; count < 10000; ++count)
+    {
+        invoke_changing(*object);
+    }
+
+    // Two checks of the guard, then DRTI_REPROFILE_CALLS with the
+    // original code and some slack
+    for(int count = 0; count < 5000; ++count)
+    {
+        const void* result = invoke_changing(*derived);
+        if(result == inlined)
+        {
+            std::cout << "test15 failed: guard passed the derived class\n";
+            return result_type::fail;
+        }
+        if(result != original)
+        {
+            std::cout << "test15 passed\n";
+            return result_type::pass;
+        }
+    }
+    std::cout << "test15 failed: not deoptimized and recompiled\n";
+    return result_type::fail;
+}
+
+NOT_INLINED static result_type test16()
+{
+    // Loading another implementation of sole_interface must put back
+    // the original code for any call devirtualised to sole_impl, and
+    // the recompiled code must then guard the call
+    std::unique_ptr<drti_test::sole_interface> object(
+        drti_test::sole_interface::create());
+
+    const void* original = nullptr;
+    const void* last_result = nullptr;
+
+    for(int count = 0; count < 1000 && !original; ++count)
+    {
+        if(invoke_sole(*object, last_result))
+        {
+            original = last_result;
+        }
+    }
+
+    if(!original)
+    {
+        std::cout << "test16 failed: return value never changed\n";
+        return result_type::fail;
+    }
+
+    const int64_t guards = drti::guards_installed();
+
+    // Never closed, since recompiled code can refer to it
+    void* plugin = dlopen("./libtest_plugin-drti.so", RTLD_NOW);
+    if(!plugin)
+    {
+        std::cout << "test16 failed: " << dlerror() << "\n";
+        return result_type::fail;
+    }
+
+    using create_type = drti_test::sole_interface* (*)();
+    using marker_type = const void* (*)();
+    std::unique_ptr<drti_test::sole_interface> loaded(
+        reinterpret_cast<create_type>(
+            dlsym(plugin, "drti_test_create_plugin"))());
+    const void* marker = reinterpret_cast<marker_type>(
+        dlsym(plugin, "drti_test_plugin_marker"))();
+
+    // The original code is back in place for this call, which lands
+    // again and gets recompiled
+    const void* expected = original;
+    if(whole_program() && invoke_sole(*object, expected))
+    {
+        std::cout << "test16 failed: devirtualised code still installed\n";
+        return result_type::fail;
+    }
+
+    for(int count = 0; count < 1000; ++count)
+    {
+        const void* expected_marker = marker;
+        if(invoke_sole(*loaded, expected_marker))
+        {
+            std::cout << "test16 failed: called the wrong implementation\n";
+            return result_type::fail;
+        }
+        invoke_sole(*object, last_result);
+    }
+
+    if(drti::guards_installed() == guards)
+    {
+        std::cout << "test16 failed: no guarded code installed\n";
+        return result_type::fail;
+    }
+
+    std::cout << "test16 passed\n";
+    return result_type::pass;
+}
+
 bool all_passed(int external_data)
 {
     int tried = 0;
@@ -252,6 +871,17 @@ bool all_passed(int external_data)
     check(test3(external_data));
     check(test4());
     check(test5());
+    check(test6());
+    check(test7(external_data));
+    check(test8(external_data));
+    check(test9(external_data));
+    check(test10());
+    check(test11());
+    check(test12());
+    check(test13());
+    check(test14());
+    check(test15());
+    check(test16());
 
     std::cout
         << "Ran "
@@ -26,12 +26,43 @@
 #include "test_class.hpp"
 #include "test_support.hpp"
 
+#include <cstdlib>
+#include <iostream>
+
 namespace drti_test
 {
     struct impl : interface
     {
         const void* virtual_function() const override;
     };
+
+    struct derived_impl : impl
+    {
+    };
+
+    struct primary
+    {
+        virtual ~primary() = default;
+        virtual int primary_function() const { return 0; }
+    };
+
+    struct secondary_impl : primary, interface
+    {
+        const void* virtual_function() const override;
+
+        //! Detects calls with a wrongly adjusted this pointer
+        const secondary_impl* const m_self = this;
+    };
+
+    struct sole_impl : sole_interface
+    {
+        const void* sole_function() const override;
+    };
+
+    struct algorithm_impl : algorithm
+    {
+        const char* step() const override;
+    };
 }
 
 const void* drti_test::impl::virtual_function() const
@@ -39,12 +70,53 @@ const void* drti_test::impl::virtual_function() const
     return instruction_pointer();
 }
 
+const void* drti_test::secondary_impl::virtual_function() const
+{
+    if(m_self != this)
+    {
+        std::cerr << "secondary_impl called with bad this pointer\n";
+        std::abort();
+    }
+    return instruction_pointer();
+}
+
+const void* drti_test::sole_impl::sole_function() const
+{
+    return instruction_pointer();
+}
+
+const void* drti_test::algorithm::run() const
+{
+    return step();
+}
+
+const char* drti_test::algorithm_impl::step() const
+{
+    return static_cast<const char*>(instruction_pointer());
+}
+
 std::unique_ptr<drti_test::interface> drti_test::interface::create()
 {
     return std::make_unique<impl>();
 }
 
-// Support interface->foo() virtual function calls to be inlined
-// against impl->foo(). To avoid having to provide this information
-// manually we'd need some DRTI-specific support in the C++ front-end
-DRTI_CONVERTIBLE(drti_test::interface*, drti_test::impl*);
+std::unique_ptr<drti_test::interface> drti_test::interface::create_secondary()
+{
+    return std::make_unique<secondary_impl>();
+}
+
+std::unique_ptr<drti_test::interface> drti_test::interface::create_derived()
+{
+    return std::make_unique<derived_impl>();
+}
+
+std::unique_ptr<drti_test::sole_interface>
+drti_test::sole_interface::create()
+{
+    return std::make_unique<sole_impl>();
+}
+
+std::unique_ptr<drti_test::algorithm> drti_test::algorithm::create()
+{
+    return std::make_unique<algorithm_impl>();
+}
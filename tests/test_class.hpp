@@ -38,12 +38,44 @@ namespace drti_test
         virtual const void* virtual_function() const = 0;
 
         static std::unique_ptr<interface> create();
+        //! Creates an implementation with interface as a secondary
+        //! base class, so virtual calls go via a this-adjusting thunk
+        static std::unique_ptr<interface> create_secondary();
+        //! Creates a class derived from the create() one which
+        //! inherits its virtual_function, so calls go to the same
+        //! target with a different vtable
+        static std::unique_ptr<interface> create_derived();
+    };
+
+    //! An interface with only one implementation
+    struct sole_interface
+    {
+        virtual ~sole_interface() = default;
+        virtual const void* sole_function() const = 0;
+
+        static std::unique_ptr<sole_interface> create();
+    };
+
+    //! A template method making virtual calls on itself
+    struct algorithm
+    {
+        virtual ~algorithm() = default;
+        //! Returns whatever step() returns
+        virtual const void* run() const;
+        //! Returns an address in its own code. Not the same type as
+        //! run(), so calls to it aren't decorated and only get
+        //! inlined if the caller is customised
+        virtual const char* step() const = 0;
+
+        static std::unique_ptr<algorithm> create();
     };
 
     //! This is a workaround to allow us to name (via the
     //! drti_test_targets.txt file) the type of the virtual function
     //! calls that we want to inline.
     inline const void* type_matched_function(const interface*);
+    inline const void* type_matched_function(const sole_interface*);
+    inline const void* type_matched_function(const algorithm*);
 }
 
 // We never actually call this but we need it to be available by name
@@ -54,4 +86,16 @@ __attribute__((used)) inline const void* drti_test::type_matched_function(
     return nullptr;
 }
 
+__attribute__((used)) inline const void* drti_test::type_matched_function(
+    const sole_interface*)
+{
+    return nullptr;
+}
+
+__attribute__((used)) inline const void* drti_test::type_matched_function(
+    const algorithm*)
+{
+    return nullptr;
+}
+
 #endif // test_class_rmg_20200824_included
@@ -0,0 +1,58 @@
+// -*- mode:c++ -*-
+//
+// Module test_plugin.cpp
+//
+// A second implementation of drti_test::sole_interface, in a shared
+// library that raw_tests loads with dlopen after the runtime has
+// devirtualised calls to the first one
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "test_class.hpp"
+
+namespace drti_test
+{
+    struct plugin_impl : sole_interface
+    {
+        const void* sole_function() const override;
+    };
+
+    //! What plugin_impl::sole_function returns
+    const char plugin_marker = 0;
+}
+
+const void* drti_test::plugin_impl::sole_function() const
+{
+    return &plugin_marker;
+}
+
+//! Looked up with dlsym
+extern "C" drti_test::sole_interface* drti_test_create_plugin()
+{
+    return new drti_test::plugin_impl;
+}
+
+//! Looked up with dlsym
+extern "C" const void* drti_test_plugin_marker()
+{
+    return &drti_test::plugin_marker;
+}
@@ -33,14 +33,13 @@ extern const void* test_target1();
 extern const void* test_target2();
 extern const void* test_target3();
 extern const void* test_target4(bool);
+extern const void* test_target5(int index, int& value, const int*& address);
 
 //! Generate a support function to allow DRTI to convert between
-//! (pointer) types at runtime. This is necessary to make virtual
-//! function calls work, since during inlining a call to (e.g.) void
-//! virtual_function(base*) actually resolves to void
-//! virtual_function(derived*). This is really just a workaround; to
-//! make this work properly we would want the C++ front-end to provide
-//! something equivalent to this.
+//! (pointer) types at runtime. The runtime converts the receiver of
+//! virtual function calls itself, using the vtable target and any
+//! this-adjusting thunk, so this is only needed for other
+//! conversions or calls via thunks in undecorated modules.
 #define DRTI_CONVERTIBLE(SOURCE_TYPE, TARGET_TYPE)     \
     __attribute__((used, always_inline)) static inline \
     TARGET_TYPE __drti_converter(                      \
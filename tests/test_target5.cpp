@@ -0,0 +1,45 @@
+// -*- mode:c++ -*-
+//
+// Module test_target5.cpp
+//
+// Copyright (c) 2026 Raoul M. Gough
+//
+// This file is part of DRTI.
+//
+// DRTI is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, version 3 only.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// History
+// =======
+// 2026/10/18   rmg     File creation
+//
+
+#include "test_support.hpp"
+
+namespace
+{
+    // Only ever loaded from, so recompiled code can use its own copy.
+    // The symbol name is fixed so that the Makefile can export it
+    // from the object file for test9
+    const int folded_table[] asm("drti_test_folded_table") = { 2, 3, 5, 7 };
+
+    // The address escapes via our caller, so recompiled code has to
+    // use the original
+    const int address_taken = 11;
+}
+
+const void* test_target5(int index, int& value, const int*& address)
+{
+    value = folded_table[index & 3];
+    address = &address_taken;
+    return drti_test::instruction_pointer();
+}